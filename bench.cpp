@@ -0,0 +1,286 @@
+#include <iostream>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <cstring>
+#include <cosched2/scheduled_thread.hpp>
+#include <cosched2/context.hpp>
+#include <cosched2/fiber_local.hpp>
+#include <cosched2/task_arena.hpp>
+#include <unordered_map>
+#include <list>
+#include <thread>
+#include <vector>
+#ifdef __cpp_impl_coroutine
+#   include <cosched2/stackless.hpp>
+#endif
+#include "minicoro.h"
+
+
+
+static constexpr unsigned iterations = 1000000;
+
+
+template<typename HandoffFcn>
+void bench_handoff(const char *name, HandoffFcn handoff) {
+    static CoSched::Task *peers[2];
+    static std::chrono::steady_clock::time_point start;
+    CoSched::ScheduledThread thread;
+    for (unsigned id = 0; id != 2; id++) {
+        thread.create_task(name, [id, handoff] () {
+            auto& task = CoSched::Task::get_current();
+            peers[id] = &task;
+            // Wait for peer to be created
+            task.yield();
+            if (id == 0) start = std::chrono::steady_clock::now();
+            for (unsigned it = 0; it != iterations; it++) {
+                handoff(task, *peers[!id]);
+            }
+            if (id == 1) {
+                const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+                std::cout << task.get_name() << ": " << double(ns) / (iterations * 2) << "ns per hand-off" << std::endl;
+            }
+        });
+    }
+    thread.start();
+    thread.wait();
+}
+
+
+void bench_minicoro_switch() {
+    mco_desc desc = mco_desc_init([] (mco_coro *coro) {
+        for (;;) mco_yield(coro);
+    }, 0);
+    mco_coro *coro;
+    mco_create(&coro, &desc);
+    const auto start = std::chrono::steady_clock::now();
+    for (unsigned it = 0; it != iterations; it++) {
+        mco_resume(coro);
+    }
+    const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "minicoro: " << double(ns) / (iterations * 2) << "ns per switch" << std::endl;
+}
+
+#ifdef COSCHED2_HAS_NATIVE_CONTEXT
+void bench_native_switch() {
+    static void *main_sp, *coro_sp;
+    constexpr size_t stack_size = 64 * 1024;
+    void *stack = std::aligned_alloc(16, stack_size);
+    coro_sp = CoSched::make_context(stack, stack_size, [] (void *) {
+        for (;;) CoSched::switch_context(&coro_sp, main_sp);
+    }, nullptr);
+    const auto start = std::chrono::steady_clock::now();
+    for (unsigned it = 0; it != iterations; it++) {
+        CoSched::switch_context(&main_sp, coro_sp);
+    }
+    const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "native: " << double(ns) / (iterations * 2) << "ns per switch" << std::endl;
+    std::free(stack);
+}
+#endif
+
+
+void bench_tiny_tasks(bool run_inline) {
+    static unsigned counter;
+    counter = 0;
+    CoSched::ScheduledThread thread;
+    CoSched::TaskOptions options;
+    options.run_inline = run_inline;
+    const auto start = std::chrono::steady_clock::now();
+    for (unsigned it = 0; it != iterations; it++) {
+        thread.create_task("tiny", [] () {
+            counter++;
+        }, options);
+    }
+    thread.start();
+    thread.create_task("measure", [start] () {
+        const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        std::cout << (CoSched::Task::get_current().has_context() ? "coroutine" : "inline") << " tasks: " << double(ns) / iterations << "ns per task" << std::endl;
+    }, options);
+    thread.wait();
+}
+
+
+void bench_spawn_tree(const char *name, int mode) {
+    static unsigned leaves;
+    static int spawn_mode;
+    static CoSched::ScheduledThread *thread_ptr;
+    static std::function<void (unsigned)> spawn_node;
+    leaves = 0;
+    spawn_mode = mode;
+    CoSched::ScheduledThread thread;
+    thread_ptr = &thread;
+    // Every node spawns two children until depth is reached, nodes don't need a coroutine
+    static CoSched::TaskOptions options;
+    options.run_inline = true;
+    spawn_node = [] (unsigned depth) {
+        if (depth == 0) {
+            leaves++;
+            return;
+        }
+        for (unsigned child = 0; child != 2; child++) {
+            auto fcn = [depth] () {spawn_node(depth - 1);};
+            if (spawn_mode == 0) thread_ptr->create_task("node", fcn, options);
+            else CoSched::Task::get_current().get_scheduler().spawn("node", fcn, options, spawn_mode == 2);
+        }
+    };
+    const auto start = std::chrono::steady_clock::now();
+    thread.create_task("root", [] () {spawn_node(18);}, options);
+    thread.start();
+    thread.wait();
+    const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    std::cout << name << ": " << double(ns) / (leaves * 2 - 1) << "ns per task" << std::endl;
+}
+
+
+template<typename AccessFcn>
+void bench_task_local(const char *name, AccessFcn access) {
+    static std::chrono::steady_clock::time_point start;
+    CoSched::ScheduledThread thread;
+    constexpr unsigned task_count = 64, rounds = 16;
+    for (unsigned id = 0; id != task_count; id++) {
+        thread.create_task(name, [id, access, name] () {
+            auto& task = CoSched::Task::get_current();
+            if (id == 0) start = std::chrono::steady_clock::now();
+            // Interleave with other tasks so the value can't be cached across accesses
+            for (unsigned round = 0; round != rounds; round++) {
+                for (unsigned it = 0; it != iterations / task_count / rounds; it++) {
+                    access()++;
+                }
+                task.yield();
+            }
+            if (id == task_count - 1) {
+                const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+                std::cout << name << ": " << double(ns) / iterations << "ns per access" << std::endl;
+            }
+        });
+    }
+    thread.start();
+    thread.wait();
+}
+
+
+void bench_task_allocations(bool arena) {
+    // Request like tasks on several threads making many small allocations that die with the task
+    constexpr unsigned thread_count = 4, task_count = 1000, allocations = 1000;
+    CoSched::TaskOptions options;
+    options.arena = arena;
+    std::vector<std::unique_ptr<CoSched::ScheduledThread>> threads;
+    for (unsigned thread_id = 0; thread_id != thread_count; thread_id++) {
+        auto& thread = *threads.emplace_back(std::make_unique<CoSched::ScheduledThread>());
+        for (unsigned it = 0; it != task_count; it++) {
+            thread.create_task("request", [] () {
+                std::pmr::list<unsigned> list(CoSched::Task::get_current().get_memory_resource());
+                for (unsigned allocation = 0; allocation != allocations; allocation++) {
+                    list.push_back(allocation);
+                    if (allocation % 100 == 0) CoSched::Task::get_current().yield();
+                }
+            }, options);
+        }
+    }
+    const auto start = std::chrono::steady_clock::now();
+    for (auto& thread : threads) thread->start();
+    for (auto& thread : threads) thread->wait();
+    const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    std::cout << (arena ? "arena" : "malloc") << " allocations: " << double(ns) / (thread_count * task_count * allocations) << "ns per allocation";
+    if (arena) std::cout << ", high water " << threads[0]->get_scheduler().get_arena_high_water() << " bytes";
+    std::cout << std::endl;
+}
+
+
+size_t get_resident_memory() {
+    // Second field of statm is resident pages
+    size_t pages = 0;
+    std::ifstream statm("/proc/self/statm");
+    statm >> pages >> pages;
+    return pages * 4096;
+}
+
+void bench_stack_memory(unsigned task_count, bool shared_stack) {
+    static size_t baseline;
+    baseline = get_resident_memory();
+    CoSched::ScheduledThread thread;
+    CoSched::TaskOptions options;
+    options.shared_stack = shared_stack;
+    for (unsigned it = 0; it != task_count; it++) {
+        thread.create_task("idle", [] () {
+            auto& task = CoSched::Task::get_current();
+            // Use a bit of stack, then park
+            volatile char buffer[1024];
+            std::memset(const_cast<char*>(buffer), 1, sizeof(buffer));
+            task.set_suspended(true);
+            task.yield();
+        }, options);
+    }
+    thread.create_task("measure", [task_count, shared_stack] () {
+        const auto used = get_resident_memory() - baseline;
+        std::cout << (shared_stack ? "shared" : "private") << " stacks: " << used / task_count << " bytes resident per suspended task" << std::endl;
+        // Let everything finish
+        for (auto& task : CoSched::Task::get_current().get_scheduler().get_tasks()) {
+            task->set_suspended(false);
+        }
+    });
+    thread.start();
+    thread.wait();
+}
+
+#ifdef __cpp_impl_coroutine
+void bench_stackless_memory(unsigned task_count) {
+    static size_t baseline;
+    baseline = get_resident_memory();
+    CoSched::ScheduledThread thread;
+    for (unsigned it = 0; it != task_count; it++) {
+        thread.create_stackless_task("idle", [] () -> CoSched::Stackless {
+            // Park
+            CoSched::Task::get_current().set_suspended(true);
+            co_await CoSched::yield();
+        });
+    }
+    thread.create_task("measure", [task_count] () {
+        const auto used = get_resident_memory() - baseline;
+        std::cout << "stackless: " << used / task_count << " bytes resident per suspended task" << std::endl;
+        // Let everything finish
+        for (auto& task : CoSched::Task::get_current().get_scheduler().get_tasks()) {
+            task->set_suspended(false);
+        }
+    });
+    thread.start();
+    thread.wait();
+}
+#endif
+
+
+int main(int argc, char **argv) {
+    bench_minicoro_switch();
+#ifdef COSCHED2_HAS_NATIVE_CONTEXT
+    bench_native_switch();
+#endif
+    bench_handoff("yield", [] (CoSched::Task& task, CoSched::Task&) {
+        task.yield();
+    });
+    bench_handoff("yield_to", [] (CoSched::Task& task, CoSched::Task& peer) {
+        task.yield_to(peer);
+    });
+    bench_tiny_tasks(false);
+    bench_tiny_tasks(true);
+    bench_spawn_tree("create_task() tree", 0);
+    bench_spawn_tree("spawn() tree", 1);
+    bench_spawn_tree("spawn() tree, run next", 2);
+    static CoSched::FiberLocal<unsigned> fiber_local;
+    bench_task_local("FiberLocal", [] () -> unsigned& {
+        return *fiber_local;
+    });
+    static std::unordered_map<CoSched::Task*, unsigned> task_map;
+    bench_task_local("map keyed by task", [] () -> unsigned& {
+        return task_map[&CoSched::Task::get_current()];
+    });
+    bench_task_allocations(false);
+    bench_task_allocations(true);
+    // Task count for memory benchmark can be given as argument
+    const unsigned task_count = argc > 1 ? std::atoi(argv[1]) : 1000000;
+    bench_stack_memory(task_count, true);
+    bench_stack_memory(task_count, false);
+#ifdef __cpp_impl_coroutine
+    bench_stackless_memory(task_count);
+#endif
+}
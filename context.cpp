@@ -0,0 +1,124 @@
+#include "cosched2/context.hpp"
+
+
+
+#if defined(COSCHED2_HAS_NATIVE_CONTEXT) && defined(__x86_64__)
+__asm__(
+    ".text\n"
+#ifdef __MACH__
+    ".globl _cosched2_switch_context\n"
+    "_cosched2_switch_context:\n"
+#else
+    ".globl cosched2_switch_context\n"
+    ".type cosched2_switch_context, @function\n"
+    "cosched2_switch_context:\n"
+#endif
+    // Save callee-saved registers and floating point control state
+    "    pushq %rbp\n"
+    "    pushq %rbx\n"
+    "    pushq %r12\n"
+    "    pushq %r13\n"
+    "    pushq %r14\n"
+    "    pushq %r15\n"
+    "    subq $8, %rsp\n"
+    "    stmxcsr (%rsp)\n"
+    "    fnstcw 4(%rsp)\n"
+    // Switch stacks
+    "    movq %rsp, (%rdi)\n"
+    "    movq %rsi, %rsp\n"
+    // Restore everything from new stack
+    "    ldmxcsr (%rsp)\n"
+    "    fldcw 4(%rsp)\n"
+    "    addq $8, %rsp\n"
+    "    popq %r15\n"
+    "    popq %r14\n"
+    "    popq %r13\n"
+    "    popq %r12\n"
+    "    popq %rbx\n"
+    "    popq %rbp\n"
+    "    ret\n"
+#ifndef __MACH__
+    ".size cosched2_switch_context, .-cosched2_switch_context\n"
+#endif
+);
+
+__asm__(
+    ".text\n"
+#ifdef __MACH__
+    ".globl _cosched2_context_trampoline\n"
+    "_cosched2_context_trampoline:\n"
+#else
+    ".globl cosched2_context_trampoline\n"
+    ".type cosched2_context_trampoline, @function\n"
+    "cosched2_context_trampoline:\n"
+#endif
+    "    movq %r13, %rdi\n"
+    "    callq *%r12\n"
+    "    ud2\n"
+#ifndef __MACH__
+    ".size cosched2_context_trampoline, .-cosched2_context_trampoline\n"
+#endif
+);
+#elif defined(COSCHED2_HAS_NATIVE_CONTEXT) && defined(__aarch64__)
+__asm__(
+    ".text\n"
+#ifdef __MACH__
+    ".globl _cosched2_switch_context\n"
+    "_cosched2_switch_context:\n"
+#else
+    ".globl cosched2_switch_context\n"
+    ".type cosched2_switch_context, %function\n"
+    "cosched2_switch_context:\n"
+#endif
+    // Save callee-saved registers, including link register
+    "    sub sp, sp, #160\n"
+    "    stp x19, x20, [sp, #0]\n"
+    "    stp x21, x22, [sp, #16]\n"
+    "    stp x23, x24, [sp, #32]\n"
+    "    stp x25, x26, [sp, #48]\n"
+    "    stp x27, x28, [sp, #64]\n"
+    "    stp x29, x30, [sp, #80]\n"
+    "    stp d8, d9, [sp, #96]\n"
+    "    stp d10, d11, [sp, #112]\n"
+    "    stp d12, d13, [sp, #128]\n"
+    "    stp d14, d15, [sp, #144]\n"
+    // Switch stacks
+    "    mov x2, sp\n"
+    "    str x2, [x0]\n"
+    "    mov sp, x1\n"
+    // Restore everything from new stack
+    "    ldp x19, x20, [sp, #0]\n"
+    "    ldp x21, x22, [sp, #16]\n"
+    "    ldp x23, x24, [sp, #32]\n"
+    "    ldp x25, x26, [sp, #48]\n"
+    "    ldp x27, x28, [sp, #64]\n"
+    "    ldp x29, x30, [sp, #80]\n"
+    "    ldp d8, d9, [sp, #96]\n"
+    "    ldp d10, d11, [sp, #112]\n"
+    "    ldp d12, d13, [sp, #128]\n"
+    "    ldp d14, d15, [sp, #144]\n"
+    "    add sp, sp, #160\n"
+    "    ret\n"
+#ifndef __MACH__
+    ".size cosched2_switch_context, .-cosched2_switch_context\n"
+#endif
+);
+
+__asm__(
+    ".text\n"
+#ifdef __MACH__
+    ".globl _cosched2_context_trampoline\n"
+    "_cosched2_context_trampoline:\n"
+#else
+    ".globl cosched2_context_trampoline\n"
+    ".type cosched2_context_trampoline, %function\n"
+    "cosched2_context_trampoline:\n"
+#endif
+    "    mov x0, x20\n"
+    "    blr x19\n"
+    "    brk #0\n"
+#ifndef __MACH__
+    ".size cosched2_context_trampoline, .-cosched2_context_trampoline\n"
+#endif
+);
+#endif
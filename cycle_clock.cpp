@@ -0,0 +1,28 @@
+#include "cosched2/cycle_clock.hpp"
+
+
+
+namespace CoSched {
+double CycleClock::calibrate() {
+#if defined(__x86_64__) || defined(__i386__)
+    // Measure cycle counter against steady clock for a few milliseconds
+    const auto start_time = std::chrono::steady_clock::now();
+    const auto start_ticks = now();
+    std::chrono::steady_clock::time_point end_time;
+    do {
+        end_time = std::chrono::steady_clock::now();
+    } while (end_time - start_time < std::chrono::milliseconds(5));
+    const auto end_ticks = now();
+    return static_cast<double>(end_ticks - start_ticks)
+         / static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(end_time - start_time).count());
+#elif defined(__aarch64__)
+    // Counter frequency is provided by the system
+    uint64_t freq;
+    asm volatile("mrs %0, cntfrq_el0" : "=r"(freq));
+    return static_cast<double>(freq) / 1e9;
+#else
+    // Fallback clock already counts nanoseconds
+    return 1.0;
+#endif
+}
+}
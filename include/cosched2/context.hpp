@@ -0,0 +1,79 @@
+#ifndef CONTEXT_HPP
+#define CONTEXT_HPP
+#include <cstddef>
+#include <cstdint>
+
+#if (defined(__x86_64__) || defined(__aarch64__)) && !defined(_WIN32)
+#   define COSCHED2_HAS_NATIVE_CONTEXT
+#endif
+
+
+namespace CoSched {
+// Stack that tasks take turns on, only the task that ran on it last has its frames in place
+struct SharedStack {
+    void *memory = nullptr;
+    size_t size = 0;
+    struct NativeContext *owner = nullptr;
+    bool watermarked = false; // Unused part is kept filled for stack watermarking
+};
+
+
+// Execution context of a task when using the native context switch backend
+// (CMake option COSCHED2_NATIVE_CONTEXT), unused with minicoro
+struct NativeContext {
+    void *sp = nullptr; // Stack pointer saved on last switch away
+    void *stack = nullptr;
+    size_t stack_size = 0;
+    // Used stack part copied out of shared stack while another task is using it
+    SharedStack *shared_stack = nullptr;
+    void *save_buffer = nullptr;
+    size_t save_size = 0;
+    size_t save_capacity = 0;
+    size_t stack_peak = 0; // Deepest use of shared stack seen when switched out, only tracked for watermarked stacks
+};
+
+
+#ifdef COSCHED2_HAS_NATIVE_CONTEXT
+extern "C" {
+// Saves callee-saved registers on the current stack, stores the stack pointer into *from_sp
+// and continues execution on to_sp, which must come from this function or make_context()
+void cosched2_switch_context(void **from_sp, void *to_sp);
+// Calls entry(arg) when switched to for the first time, entry must never return
+void cosched2_context_trampoline();
+}
+
+// Prepares a stack to be switched to by switch_context()
+inline
+void *make_context(void *stack, size_t stack_size, void (*entry)(void *), void *arg) {
+    // Stack grows down from a 16 byte aligned top
+    auto top = reinterpret_cast<uintptr_t>(stack) + stack_size;
+    top &= ~uintptr_t(15);
+    auto frame = reinterpret_cast<void**>(top);
+#   if defined(__x86_64__)
+    // Trampoline is returned to with 16 byte aligned stack pointer
+    *--frame = reinterpret_cast<void*>(&cosched2_context_trampoline); // Return address
+    *--frame = nullptr; // rbp
+    *--frame = nullptr; // rbx
+    *--frame = reinterpret_cast<void*>(entry); // r12
+    *--frame = arg; // r13
+    *--frame = nullptr; // r14
+    *--frame = nullptr; // r15
+    *--frame = reinterpret_cast<void*>(uintptr_t(0x037F) << 32 | 0x1F80); // x87 control word, MXCSR
+#   elif defined(__aarch64__)
+    // x19-x30 followed by d8-d15
+    frame -= 20;
+    for (unsigned i = 0; i != 20; i++) frame[i] = nullptr;
+    frame[0] = reinterpret_cast<void*>(entry); // x19
+    frame[1] = arg; // x20
+    frame[11] = reinterpret_cast<void*>(&cosched2_context_trampoline); // x30
+#   endif
+    return frame;
+}
+
+inline
+void switch_context(void **from_sp, void *to_sp) {
+    cosched2_switch_context(from_sp, to_sp);
+}
+#endif
+}
+#endif // CONTEXT_HPP
@@ -0,0 +1,44 @@
+#ifndef CYCLE_CLOCK_HPP
+#define CYCLE_CLOCK_HPP
+#include <cstdint>
+#include <chrono>
+#if defined(__x86_64__) || defined(__i386__)
+#   include <x86intrin.h>
+#endif
+
+
+namespace CoSched {
+// Cheap monotonic clock based on the CPU cycle counter where available
+// Ticks are only meaningful relative to each other, use to_ns()/from_ns() to convert
+class CycleClock {
+    static double calibrate();
+
+public:
+    static inline
+    uint64_t now() {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#elif defined(__aarch64__)
+        uint64_t fres;
+        asm volatile("mrs %0, cntvct_el0" : "=r"(fres));
+        return fres;
+#else
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+    }
+
+    // Returns the amount of ticks per nanosecond, measured once on first use
+    static double get_ticks_per_ns() {
+        static const double fres = calibrate();
+        return fres;
+    }
+
+    static uint64_t from_ns(uint64_t ns) {
+        return static_cast<uint64_t>(static_cast<double>(ns) * get_ticks_per_ns());
+    }
+    static uint64_t to_ns(uint64_t ticks) {
+        return static_cast<uint64_t>(static_cast<double>(ticks) / get_ticks_per_ns());
+    }
+};
+}
+#endif // CYCLE_CLOCK_HPP
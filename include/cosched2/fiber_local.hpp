@@ -0,0 +1,55 @@
+#ifndef FIBER_LOCAL_HPP
+#define FIBER_LOCAL_HPP
+#include "scheduler.hpp"
+
+#include <atomic>
+
+
+namespace CoSched {
+class FiberLocalBase {
+protected:
+    size_t index;
+
+    // Slots are shared by fiber locals of all types
+    FiberLocalBase() {
+        static std::atomic<size_t> next_index = 0;
+        index = next_index.fetch_add(1, std::memory_order_relaxed);
+    }
+};
+
+
+// Value that exists once per task, like thread_local does per thread
+// It is constructed on first access from within a task and destroyed along with the task
+// Instances are meant to be static, slots of destroyed instances aren't reused
+template<typename T>
+class FiberLocal : FiberLocalBase {
+public:
+    FiberLocal() {}
+    FiberLocal(const FiberLocal&) = delete;
+    FiberLocal(FiberLocal&&) = delete;
+
+    // Returns the value of given task, constructing it if needed
+    T& get(Task& task) const {
+        auto& slot = task.get_local(index);
+        if (!slot.value) {
+            slot.value = new T();
+            slot.destroy = [] (void *value) {
+                delete static_cast<T*>(value);
+            };
+        }
+        return *static_cast<T*>(slot.value);
+    }
+    // Returns the value of the current task, constructing it if needed
+    T& get() const {
+        return get(Task::get_current());
+    }
+
+    T& operator *() const {
+        return get();
+    }
+    T *operator ->() const {
+        return &get();
+    }
+};
+}
+#endif // FIBER_LOCAL_HPP
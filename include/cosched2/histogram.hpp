@@ -0,0 +1,121 @@
+#ifndef HISTOGRAM_HPP
+#define HISTOGRAM_HPP
+#include "cycle_clock.hpp"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+
+namespace CoSched {
+// Log-linear bucketing of durations in cycle clock ticks, like HDR histograms do
+// Every power of two is split into 16 linear sub buckets, so values are kept with a relative error of at most 1/16
+struct HistogramBuckets {
+    static constexpr unsigned sub_bucket_bits = 4;
+    static constexpr unsigned sub_buckets = 1 << sub_bucket_bits;
+    static constexpr unsigned count = (64 - sub_bucket_bits + 1) * sub_buckets;
+
+    static unsigned get_index(uint64_t value) {
+        if (value < sub_buckets) return static_cast<unsigned>(value);
+#ifdef __GNUC__
+        const unsigned exponent = 63 - __builtin_clzll(value);
+#else
+        unsigned exponent = 63;
+        while (!(value >> exponent)) exponent--;
+#endif
+        const unsigned shift = exponent - sub_bucket_bits;
+        return (shift + 1) * sub_buckets + static_cast<unsigned>((value >> shift) & (sub_buckets - 1));
+    }
+
+    // Returns the highest value that ends up in bucket of given index
+    static uint64_t get_upper_bound(unsigned index) {
+        if (index < sub_buckets) return index;
+        const unsigned shift = index / sub_buckets - 1;
+        const uint64_t lower = uint64_t(sub_buckets + index % sub_buckets) << shift;
+        return lower + ((uint64_t(1) << shift) - 1);
+    }
+};
+
+
+// Copy of a histogram that can be queried and merged with others
+class HistogramSnapshot {
+    friend class Histogram;
+
+    std::array<uint64_t, HistogramBuckets::count> counts{};
+    uint64_t count = 0;
+    uint64_t sum = 0; // In cycle clock ticks
+
+public:
+    // Returns the amount of recorded values
+    uint64_t get_count() const {
+        return count;
+    }
+
+    // Returns the sum of all recorded values
+    std::chrono::nanoseconds get_sum() const {
+        return std::chrono::nanoseconds(CycleClock::to_ns(sum));
+    }
+
+    std::chrono::nanoseconds get_mean() const {
+        return count ? std::chrono::nanoseconds(CycleClock::to_ns(sum / count)) : std::chrono::nanoseconds(0);
+    }
+
+    // Returns the value given fraction (0 to 1) of recorded values are less than or equal to
+    std::chrono::nanoseconds get_percentile(double fraction) const {
+        if (!count) return std::chrono::nanoseconds(0);
+        uint64_t rank = static_cast<uint64_t>(fraction * static_cast<double>(count) + 0.5);
+        if (rank == 0) rank = 1;
+        uint64_t seen = 0;
+        for (unsigned index = 0; index != counts.size(); index++) {
+            seen += counts[index];
+            if (seen >= rank) return std::chrono::nanoseconds(CycleClock::to_ns(HistogramBuckets::get_upper_bound(index)));
+        }
+        return get_max();
+    }
+
+    std::chrono::nanoseconds get_max() const {
+        for (unsigned index = counts.size(); index-- != 0;) {
+            if (counts[index]) return std::chrono::nanoseconds(CycleClock::to_ns(HistogramBuckets::get_upper_bound(index)));
+        }
+        return std::chrono::nanoseconds(0);
+    }
+
+    // Adds values of a histogram of another thread
+    HistogramSnapshot& operator +=(const HistogramSnapshot& o) {
+        for (unsigned index = 0; index != counts.size(); index++) {
+            counts[index] += o.counts[index];
+        }
+        count += o.count;
+        sum += o.sum;
+        return *this;
+    }
+};
+
+
+// Histogram of durations, recording is lock free and cheap but MUST only be done from one thread
+// Snapshots can be taken from any thread
+class Histogram {
+    std::array<std::atomic<uint64_t>, HistogramBuckets::count> counts{};
+    std::atomic<uint64_t> sum = 0;
+
+public:
+    // Records a duration in cycle clock ticks
+    void record(uint64_t ticks) {
+        auto& bucket = counts[HistogramBuckets::get_index(ticks)];
+        bucket.store(bucket.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        sum.store(sum.load(std::memory_order_relaxed) + ticks, std::memory_order_relaxed);
+    }
+
+    HistogramSnapshot get_snapshot() const {
+        HistogramSnapshot fres;
+        for (unsigned index = 0; index != counts.size(); index++) {
+            fres.counts[index] = counts[index].load(std::memory_order_relaxed);
+            fres.count += fres.counts[index];
+        }
+        fres.sum = sum.load(std::memory_order_relaxed);
+        return fres;
+    }
+};
+}
+#endif // HISTOGRAM_HPP
@@ -0,0 +1,73 @@
+#ifndef METRICS_HPP
+#define METRICS_HPP
+#include "scheduler.hpp"
+
+#include <string>
+#include <vector>
+#include <map>
+#include <chrono>
+
+
+namespace CoSched {
+// Snapshot of the metrics of a scheduler, see SchedulerBase::get_metrics()
+struct SchedulerMetrics {
+    std::chrono::steady_clock::time_point taken_at;
+    // Gauges
+    size_t injection_queue_size = 0; // Tasks submitted from other threads not yet created
+    std::map<Priority, size_t> ready_tasks; // Only priorities there are ready tasks of
+    size_t tasks = 0;
+    size_t suspended_tasks = 0;
+    size_t arena_high_water = 0;
+    // Counters
+    uint64_t switches = 0;
+    uint64_t skipped_switches = 0;
+    uint64_t tasks_created = 0;
+    uint64_t tasks_exited = 0;
+    uint64_t stack_bytes_trimmed = 0; // Resident stack memory given back by SchedulerBase::trim_stacks()
+    std::chrono::nanoseconds busy_time{0}; // Only maintained by ScheduledThread
+    std::chrono::nanoseconds idle_time{0};
+
+    // Returns the amount of ready tasks of all priorities
+    size_t get_ready_tasks() const;
+
+    // Returns the per second rate a counter has increased at since an earlier snapshot of the same schedulers
+    double get_rate(uint64_t SchedulerMetrics::*counter, const SchedulerMetrics& earlier) const;
+
+    // Adds up metrics of multiple schedulers, high water marks are combined to their maximum
+    SchedulerMetrics& operator +=(const SchedulerMetrics& o);
+};
+
+
+// Collects metrics and histograms of schedulers, typically one per ScheduledThread, and renders them in Prometheus text format
+// Rendering can be done from any thread and never takes any of the schedulers locks
+class MetricsExporter {
+    struct Source {
+        std::string name;
+        const SchedulerBase *scheduler;
+    };
+
+    std::vector<Source> sources;
+    std::string prefix;
+
+public:
+    explicit MetricsExporter(const std::string& prefix = "cosched2_") : prefix(prefix) {}
+
+    // Adds a scheduler, its metrics are labeled with given name
+    // MUST NOT be called while rendering, scheduler MUST outlive the exporter
+    void add(const std::string& name, const SchedulerBase& scheduler) {
+        sources.push_back({name, &scheduler});
+    }
+
+    // Returns snapshots of all schedulers in the order they've been added in
+    std::vector<std::pair<std::string, SchedulerMetrics>> collect() const;
+    // Returns the metrics of all schedulers added up
+    SchedulerMetrics get_total() const;
+
+    // Renders metrics of all schedulers in Prometheus text exposition format
+    std::string render() const;
+    // Writes rendered metrics to a file, e.g. for the node exporters textfile collector
+    // File is replaced at once so readers never see partial output, returns false on failure
+    bool write(const std::string& path) const;
+};
+}
+#endif // METRICS_HPP
@@ -0,0 +1,45 @@
+#ifndef OFF_CPU_PROFILE_HPP
+#define OFF_CPU_PROFILE_HPP
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdint>
+
+
+namespace CoSched {
+// Returns the demangled name of the function a return address belongs to, or module and offset if it isn't known
+// Semicolons are replaced by colons so names can be used in folded stacks
+std::string symbolize_address(uintptr_t address);
+
+
+// Stacks of the tasks that weren't running when sampled, see SchedulerBase::sample_off_cpu()
+// Stacks are walked along frame pointers, so code MUST be compiled with -fno-omit-frame-pointer for complete stacks
+struct OffCpuProfile {
+    enum class Kind {
+        stackful,
+        stackless, // No stack to walk
+        not_started
+    };
+
+    struct Sample {
+        uint64_t task_id;
+        std::string task_name;
+        Kind kind;
+        bool suspended; // Task isn't runnable, e.g. because it is waiting for a mutex
+        std::chrono::nanoseconds parked_for; // Time since task has last stopped running
+        size_t first_frame = 0, frame_count = 0; // Range of the tasks return addresses in frames, innermost first
+    };
+
+    std::vector<Sample> samples;
+    std::vector<uintptr_t> frames;
+
+    // Symbolizes and aggregates stacks in folded format, as taken by flamegraph.pl and the like
+    // Stacks are weighted by the microseconds tasks have been parked for and start with the state of the task,
+    // optionally followed by the task name
+    // Symbolizing is slow, so this is best done outside of the scheduling thread
+    std::string to_folded(bool by_task_name = false) const;
+    // Writes folded stacks to a file, returns false on failure
+    bool write_folded(const std::string& path, bool by_task_name = false) const;
+};
+}
+#endif // OFF_CPU_PROFILE_HPP
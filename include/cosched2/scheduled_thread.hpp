@@ -1,43 +1,165 @@
 #ifndef SCHEDULED_THREAD_HPP
 #define SCHEDULED_THREAD_HPP
 #include "scheduler.hpp"
+#include "off_cpu_profile.hpp"
 
+#include <atomic>
 #include <functional>
 #include <future>
 #include <mutex>
 #include <queue>
+#include <map>
 #include <thread>
 
 
 
 namespace CoSched {
-class ScheduledThread {
-    static thread_local ScheduledThread *current;
+template<class Policy = PriorityPolicy>
+class BasicScheduledThread {
+    static inline thread_local BasicScheduledThread *current = nullptr;
 
     struct QueueEntry {
         std::string task_name;
-        std::function<void ()> start_fcn;
+        std::function<void ()> start_fcn; // Attaches coroutine to the task instead if stackless
+        TaskOptions options;
+        bool stackless = false;
+        uint64_t submitted_at = 0; // Cycle clock tick
     };
 
     std::thread thread;
     std::mutex queue_mutex;
-    std::queue<QueueEntry> queue;
+    std::map<Priority, std::queue<QueueEntry>, std::greater<Priority>> queues; // Highest priority first
     std::mutex conditional_mutex;
     std::condition_variable conditional_lock;
     bool shutdown_requested = false;
     bool joined = false;
+    size_t admission_limit = 64;
+    std::function<void (BasicScheduler<Policy>&)> periodic_hook;
+    uint64_t periodic_interval = 0, next_periodic = 0; // In cycle clock ticks
+    uint64_t trim_interval = 0, next_trim = 0; // In cycle clock ticks, 0 if stacks aren't trimmed
+    std::chrono::nanoseconds trim_min_parked{0};
+    bool trim_lazy = false;
+    std::function<void (OffCpuProfile&&)> off_cpu_profile_hook;
+    std::atomic<bool> off_cpu_profile_requested = false;
+    BasicScheduler<Policy> sched;
 
-    void main_loop();
+    void enqueue(QueueEntry&& entry) {
+        entry.submitted_at = CycleClock::now();
+        // Enqueue function
+        {
+            std::scoped_lock L(queue_mutex);
+            queues[entry.options.priority].push(std::move(entry));
+            sched.injection_queue_size.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        // Notify thread, locking makes sure it isn't about to wait
+        std::scoped_lock L(conditional_mutex);
+        conditional_lock.notify_one();
+    }
+
+    void run_periodic_hook() {
+        periodic_hook(sched);
+        next_periodic = CycleClock::now() + periodic_interval;
+    }
+
+    void run_stack_trimming() {
+        sched.trim_stacks(trim_min_parked, trim_lazy);
+        next_trim = CycleClock::now() + trim_interval;
+    }
+
+    // Returns how long to wait for work until the periodic hook or stack trimming is due
+    std::chrono::nanoseconds get_idle_timeout() const {
+        uint64_t due = UINT64_MAX;
+        if (periodic_hook) due = next_periodic;
+        if (trim_interval) due = std::min(due, next_trim);
+        const auto now = CycleClock::now();
+        return std::chrono::nanoseconds(due > now ? CycleClock::to_ns(due - now) : 0);
+    }
+
+    void main_loop() {
+        sched.started_at.store(CycleClock::now(), std::memory_order_relaxed);
+        // Loop until shutdown is requested
+        while (!shutdown_requested) {
+            // Admit new tasks enqueued in priority order, limited so a burst can't hold up running tasks
+            // They are started once picked by the scheduling policy
+            if (sched.injection_queue_size.load(std::memory_order_relaxed)) {
+                // Tasks of lower priority than the ready ones can wait while as many are ready as would be admitted,
+                // but one of them is admitted every round so they can't be held up forever
+                const auto& ready = sched.get_ready_index();
+                const bool saturated = ready.size() >= admission_limit;
+                const Priority highest_ready = saturated ? ready.get_highest() : PRIO_NORMAL;
+                bool lower_admitted = false;
+                std::unique_lock<std::mutex> L(queue_mutex);
+                for (size_t admitted = 0; admitted != admission_limit && !queues.empty(); admitted++) {
+                    // Get queue entry
+                    auto queue = queues.begin();
+                    if (saturated && queue->first < highest_ready) {
+                        if (lower_admitted) break;
+                        lower_admitted = true;
+                    }
+                    auto e = std::move(queue->second.front());
+                    queue->second.pop();
+                    if (queue->second.empty()) queues.erase(queue);
+                    sched.injection_queue_size.fetch_sub(1, std::memory_order_relaxed);
+                    // Unlock queue
+                    L.unlock();
+                    // Create task for it
+                    auto& task = sched.create_task(e.task_name, std::move(e.start_fcn), e.options);
+                    task.stackless = e.stackless;
+                    task.submitted_at = e.submitted_at;
+                    // Lock queue
+                    L.lock();
+                }
+            }
+            // Run once
+            sched.run_once();
+            if (periodic_hook && CycleClock::now() >= next_periodic) run_periodic_hook();
+            if (trim_interval && CycleClock::now() >= next_trim) run_stack_trimming();
+            if (off_cpu_profile_requested.load(std::memory_order_relaxed)) {
+                off_cpu_profile_requested.store(false, std::memory_order_relaxed);
+                if (off_cpu_profile_hook) off_cpu_profile_hook(sched.sample_off_cpu());
+            }
+            // Wait for work if there is none
+            if (!sched.has_work()) {
+                std::unique_lock<std::mutex> lock(conditional_mutex);
+                sched.set_idle(true);
+                const auto has_news = [this] () {
+                    return joined || sched.injection_queue_size.load(std::memory_order_relaxed);
+                };
+                if (periodic_hook || trim_interval) {
+                    // Keep calling periodic hook and trimming stacks while idle, without holding the lock so the hook may submit tasks
+                    while (!conditional_lock.wait_for(lock, get_idle_timeout(), has_news)) {
+                        lock.unlock();
+                        const auto now = CycleClock::now();
+                        if (periodic_hook && now >= next_periodic) run_periodic_hook();
+                        if (trim_interval && now >= next_trim) run_stack_trimming();
+                        lock.lock();
+                    }
+                } else {
+                    conditional_lock.wait(lock, has_news);
+                }
+                sched.set_idle(false);
+                if (!sched.injection_queue_size.load(std::memory_order_relaxed)) break;
+            }
+        }
+    }
 
 public:
-    ScheduledThread() {}
+    BasicScheduledThread() {}
+    template<typename... Args>
+    explicit BasicScheduledThread(Args&&... policy_args) : sched(std::forward<Args>(policy_args)...) {}
 
     // Current thread MUST be made by start()
     inline static
-    ScheduledThread *get_current() {
+    BasicScheduledThread *get_current() {
         return current;
     }
 
+    // Returns the scheduler, only its policy statistics may be accessed from outside the thread
+    BasicScheduler<Policy>& get_scheduler() {
+        return sched;
+    }
+
     // MUST NOT already be running
     void start() {
         thread = std::thread([this] () {
@@ -46,21 +168,83 @@ public:
         });
     }
 
+    // Returns the handle of the scheduling thread, e.g. for Watchdog::add()
+    // MUST already be running
+    std::thread::native_handle_type get_native_handle() {
+        return thread.native_handle();
+    }
+
     // Can be called from anywhere
-    void create_task(const std::string& task_name, std::function<void ()>&& task_fcn) {
-        // Enqueue function
-        {
-            std::scoped_lock L(queue_mutex);
-            queue.emplace(QueueEntry{task_name, std::move(task_fcn)});
-        }
+    void create_task(const std::string& task_name, std::function<void ()>&& task_fcn, const TaskOptions& options = {}) {
+        enqueue(QueueEntry{task_name, std::move(task_fcn), options});
+    }
 
-        // Notify thread
-        conditional_lock.notify_one();
+    // Can be called from anywhere, requires cosched2/stackless.hpp
+    // Factory is called from the scheduling thread and must return a Stackless coroutine
+    template<typename Factory>
+    void create_stackless_task(const std::string& task_name, Factory&& factory, const TaskOptions& options = {}) {
+        enqueue(QueueEntry{task_name, [factory = std::forward<Factory>(factory)] () mutable {
+            factory().attach(Task::get_current());
+        }, options, true});
+    }
+
+    // Sets how many submitted tasks are admitted per scheduling round
+    // While as many are ready, only those of at least the highest ready priority are, along with one other per round
+    // MUST NOT be called while running
+    void set_admission_limit(size_t value) {
+        admission_limit = value;
+    }
+
+    // Sets a function called from the scheduling thread about every interval, e.g. to dump histograms
+    // See SchedulerBase::get_histograms() and SchedulerBase::get_metrics()
+    // MUST NOT be called after having been started
+    void set_periodic_hook(std::chrono::nanoseconds interval, std::function<void (BasicScheduler<Policy>&)>&& hook) {
+        periodic_interval = CycleClock::from_ns(interval.count());
+        periodic_hook = std::move(hook);
+    }
+
+    // Sets a function the stacks of all tasks that aren't running are passed to once requested
+    // It is called from the scheduling thread, so it should hand the profile off before symbolizing it
+    // MUST NOT be called after having been started
+    void set_off_cpu_profile_hook(std::function<void (OffCpuProfile&&)>&& hook) {
+        off_cpu_profile_hook = std::move(hook);
+    }
+    // Requests an off-CPU profile to be passed to the hook on the next scheduling round
+    // Can be called from anywhere, including signal handlers
+    void request_off_cpu_profile() {
+        off_cpu_profile_requested.store(true, std::memory_order_relaxed);
+    }
+
+    // Sets the size of blocks task arenas are made of, see TaskOptions::arena
+    // MUST NOT be called after having been started
+    void set_arena_block_size(size_t value) {
+        sched.get_arena_pool().set_block_size(value);
+    }
+
+    // Trims the stacks of tasks that have been parked for at least min_parked every interval, even while idle
+    // See SchedulerBase::trim_stacks(), a zero interval disables trimming
+    // MUST NOT be called after having been started
+    void set_stack_trimming(std::chrono::nanoseconds min_parked, std::chrono::nanoseconds interval = std::chrono::seconds(1), bool lazy = false) {
+        trim_min_parked = min_parked;
+        trim_interval = CycleClock::from_ns(interval.count());
+        trim_lazy = lazy;
+    }
+
+    // Enables stack watermarking, see SchedulerBase::set_stack_watermark()
+    // Usage can be collected through get_stack_usage() from a periodic hook
+    // MUST NOT be called after having been started
+    void set_stack_watermark(bool value, std::function<void (const Task&, size_t)>&& peak_hook = {}) {
+        sched.set_stack_watermark(value);
+        sched.set_stack_peak_hook(std::move(peak_hook));
     }
 
     // MUST already be running
     void wait() {
-        joined = true;
+        {
+            std::scoped_lock L(conditional_mutex);
+            joined = true;
+        }
+        conditional_lock.notify_one();
         thread.join();
     }
 
@@ -71,5 +255,7 @@ public:
                 });
     }
 };
+
+using ScheduledThread = BasicScheduledThread<>;
 }
 #endif // SCHEDULED_THREAD_HPP
@@ -6,6 +6,17 @@
 #include <memory>
 #include <chrono>
 #include <functional>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include "cycle_clock.hpp"
+#include "histogram.hpp"
+#include "stack_usage.hpp"
+#include "trace_buffer.hpp"
+#include "context.hpp"
 
 struct mco_coro;
 
@@ -38,28 +49,145 @@ enum class TaskState {
 std::string_view get_state_string(TaskState);
 
 
+class TaskGroup;
+class TaskArena;
+struct SchedulerMetrics;
+struct OffCpuProfile;
+
+
+// Fiber local storage slot of a task, see FiberLocal
+struct LocalSlot {
+    void *value = nullptr;
+    void (*destroy)(void *value) = nullptr;
+};
+
+
+// Options that can be given to a task on creation
+struct TaskOptions {
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max();
+    TaskGroup *group = nullptr; // Group the task belongs to, must outlive the task
+    std::chrono::nanoseconds time_slice{0}; // Time the task may run before should_yield() returns true, 0 for the scheduler default
+    bool shared_stack = false; // Run on a shared stack, addresses of stack variables MUST NOT be used by other tasks
+    // Run to completion on the schedulers stack without a coroutine, task MUST NOT block and its yields never switch
+    // Locking a Mutex held by another task fails instead of waiting, see LockGuard::is_failed()
+    bool run_inline = false;
+    Priority priority = PRIO_NORMAL;
+    size_t stack_size = 0; // Size of private stack, 0 for the default
+    bool arena = false; // Give task a bump allocator freed as a whole once task ends, see Task::get_memory_resource()
+};
+
+
+#ifdef COSCHED2_TASK_STATS
+// Runtime accounting of a task, enabled by the CMake option COSCHED2_TASK_STATS
+// Times are in cycle clock ticks, see CycleClock::to_ns()
+struct TaskStats {
+    uint64_t resumes = 0; // Times the task has been switched to
+    uint64_t run_time = 0; // Time spent running
+    uint64_t ready_time = 0; // Time spent runnable but not running
+    uint64_t wait_time = 0; // Time spent parked in waits like those of mutexes
+    uint64_t longest_run = 0; // Longest time the task has run for without switching away
+};
+#endif
+
+
 class Task {
-    friend class Scheduler;
-    friend class ScheduledThread;
+    friend class SchedulerBase;
+    template<class> friend class BasicScheduler;
+    template<class> friend class BasicScheduledThread;
+    friend class FairPolicyBase;
+    friend class FairPolicy;
+    template<class> friend class DeadlinePolicy;
+    friend class GroupPolicy;
+    friend class PriorityPolicy;
+    friend class YieldAwaiter;
+    friend class Stackless;
+    friend class FramePool;
+    friend class Watchdog;
+    friend class TaskScope;
+    friend class TaskScopeState;
 
     static thread_local class Task *current;
 
-    class Scheduler *scheduler;
+    class SchedulerBase *scheduler;
+    uint64_t id = 0;
+    size_t index = 0; // Position in schedulers task list
     Coroutine coroutine = nullptr;
+    NativeContext context;
+    void *frame = nullptr; // Coroutine frame if task is stackless
+    bool (*frame_resume)(void *frame) = nullptr; // Returns true once coroutine has finished
+    void (*frame_destroy)(void *frame) = nullptr;
 
     std::function<void ()> start_fcn;
+    std::vector<LocalSlot> locals; // Indexed by FiberLocal slot
+    TaskArena *arena = nullptr;
 
-    std::chrono::system_clock::time_point stopped_at;
+    std::chrono::steady_clock::time_point stopped_at;
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max();
+    std::chrono::steady_clock::time_point queued_deadline; // Deadline the task has been queued with by DeadlinePolicy
+    std::chrono::steady_clock::time_point queued_stopped_at; // Stop time the task has been queued with by PriorityPolicy
 
     std::string name;
+    TaskGroup *group = nullptr;
+    class TaskScopeState *scope = nullptr; // Scope the task has been spawned in
+    TaskScopeState *owned_scope = nullptr; // Innermost scope owned by the task
+    void *wait_object = nullptr; // Wait the task is parked in
+    void (*wait_cancel)(void *wait_object, Task& task) = nullptr; // Removes task from wait, nullptr once woken up
     Priority priority = PRIO_NORMAL;
     TaskState state = TaskState::running;
     bool suspended = false;
+    bool queued = false; // Task is currently known to the scheduling policy as ready
+    bool requeue = false; // Task needs to be removed from and readded to the scheduling policy
+    bool in_pending = false; // Task is in the schedulers pending list
+    bool shared_stack = false; // Task wants to run on a shared stack
+    bool wait_cancelled = false; // Last wait has been cancelled by termination
+    bool run_inline = false; // Task runs to completion on the schedulers stack
+    bool stackless = false; // Start function attaches a coroutine frame to the task on launch
+    bool stack_watermark = false; // Stack has been filled on launch so its peak usage can be measured
+    size_t stack_size = 0; // 0 for the default
+    uint64_t vruntime = 0; // Weighted runtime in cycle clock ticks, maintained by fair policies
+    uint64_t time_slice = 0; // In cycle clock ticks, 0 for the scheduler default
+    uint64_t slice_end = 0; // Cycle clock tick the current time slice is used up at
+    Priority queued_priority = PRIO_NORMAL; // Priority the task has been queued with
+    Task *ready_prev = nullptr, *ready_next = nullptr; // Links in ready list of PriorityPolicy
+    uint64_t submitted_at = 0; // Cycle clock tick, 0 once first resumed
+    uint64_t woken_at = 0; // Cycle clock tick of last wake up, 0 once resumed
+    uint64_t parked_at = 0; // Cycle clock tick
+    std::chrono::steady_clock::time_point trimmed_stop; // stopped_at of the stop the stack has last been trimmed in
+#ifdef COSCHED2_TASK_STATS
+    TaskStats stats;
+    uint64_t run_started_at = 0; // 0 while not running
+    uint64_t ready_since = 0; // 0 while not ready
+
+    void start_run(uint64_t now) {
+        stats.resumes++;
+        run_started_at = now;
+        stop_ready(now);
+    }
+    void stop_run(uint64_t now) {
+        if (!run_started_at) return;
+        const uint64_t run = now - run_started_at;
+        stats.run_time += run;
+        if (run > stats.longest_run) stats.longest_run = run;
+        run_started_at = 0;
+    }
+    void stop_ready(uint64_t now) {
+        if (!ready_since) return;
+        stats.ready_time += now - ready_since;
+        ready_since = 0;
+    }
+#endif
 
     void kill();
 
+    // Shared by stackful and stackless yields
+    // Returns false if no switch is needed, with result set to what yield should return
+    bool prepare_yield(bool& result);
+    bool finish_yield();
+    // Yields even if task is terminating or dead, state is kept
+    void wait_resumed();
+
 public:
-    Task(Scheduler *scheduler, const std::string& name)
+    Task(SchedulerBase *scheduler, const std::string& name)
         : scheduler(scheduler), name(name) {}
     Task(const Task&) = delete;
     Task(Task&&) = delete;
@@ -70,6 +198,11 @@ public:
         return *current;
     }
 
+    // Returns a number unique to this task within its scheduler, increasing in creation order
+    uint64_t get_id() const {
+        return id;
+    }
+
     // Sets a task name
     const std::string& get_name() const {
         return name;
@@ -78,6 +211,11 @@ public:
         name = value;
     }
 
+    // Returns the group the task has been created in, if any
+    TaskGroup *get_group() const {
+        return group;
+    }
+
     // Sets the task priority
     Priority get_priority() const {
         return priority;
@@ -94,20 +232,75 @@ public:
         return ::CoSched::get_state_string(state);
     }
 
+    // Returns fiber local storage slot of given index, see FiberLocal
+    LocalSlot& get_local(size_t index) {
+        if (index >= locals.size()) locals.resize(index + 1);
+        return locals[index];
+    }
+
+    // Returns the arena of the task if it has been created with one
+    TaskArena *get_arena() const {
+        return arena;
+    }
+    // Returns the arena of the task or the default memory resource if it has none
+    std::pmr::memory_resource *get_memory_resource() const;
+
     // Returns the scheduler that is scheduling this task
-    Scheduler& get_scheduler() const {
+    SchedulerBase& get_scheduler() const {
         return *scheduler;
     }
 
-    // Terminates the task as soon as possible
-    void terminate() {
-        state = TaskState::terminating;
+    // Returns the deepest the task has used its stack so far in bytes, 0 unless it has been launched with
+    // stack watermarking enabled, see SchedulerBase::set_stack_watermark()
+    // MUST only be called from the scheduling thread
+    size_t get_stack_peak() const;
+
+    // Returns the point in time the task has last yielded at
+    std::chrono::steady_clock::time_point get_stopped_at() const {
+        return stopped_at;
     }
 
-    // Suspends (pauses) the task as soon as possible
-    void set_suspended(bool value = true) {
-        suspended = value;
+#ifdef COSCHED2_TASK_STATS
+    // Returns the runtime accounting of this task, MUST only be called from the scheduling thread
+    const TaskStats& get_stats() const {
+        return stats;
+    }
+#endif
+
+    // Returns the weighted runtime of this task if a fair policy is used
+    uint64_t get_vruntime() const {
+        return vruntime;
     }
+
+    // Sets a deadline, tasks with a deadline are run in deadline order ahead of others by DeadlinePolicy
+    std::chrono::steady_clock::time_point get_deadline() const {
+        return deadline;
+    }
+    void set_deadline(std::chrono::steady_clock::time_point value);
+    void clear_deadline() {
+        set_deadline(std::chrono::steady_clock::time_point::max());
+    }
+    bool has_deadline() const {
+        return deadline != std::chrono::steady_clock::time_point::max();
+    }
+
+    // Terminates the task as soon as possible, along with all tasks in scopes owned by it
+    // Task is woken up from any wait it is parked in
+    void terminate();
+
+    // Suspends task in a wait, switching away is up to the caller
+    // Termination calls cancel to remove the task from the waits queue and resumes it
+    // MUST only be called from the task itself
+    inline void park(void *wait_object, void (*cancel)(void *wait_object, Task& task));
+    // Resumes task parked in a wait, for the waking side
+    inline void unpark();
+    // Checks if last wait of the task has been cancelled by termination
+    bool is_wait_cancelled() const {
+        return wait_cancelled;
+    }
+
+    // Suspends (pauses) the task as soon as possible
+    void set_suspended(bool value = true);
     bool is_suspended() const {
         return suspended;
     }
@@ -117,25 +310,464 @@ public:
         return state == TaskState::dead;
     }
 
+    // Returns if task has been started
+    bool has_context() const {
+        return coroutine || context.sp || frame;
+    }
+
+    // Returns if task is a stackless coroutine, those MUST NOT call yield() and the like
+    bool is_stackless() const {
+        return frame;
+    }
+
+    // Returns if task runs to completion on the schedulers stack, those MUST NOT block
+    bool is_inline() const {
+        return run_inline;
+    }
+
+    // Returns if task could be resumed right now
+    bool is_runnable() const {
+        return !suspended && state != TaskState::running && state != TaskState::deleting;
+    }
+
+    // Sets the time the task may run for before should_yield() returns true
+    std::chrono::nanoseconds get_time_slice() const {
+        return std::chrono::nanoseconds(CycleClock::to_ns(time_slice));
+    }
+    void set_time_slice(std::chrono::nanoseconds value) {
+        time_slice = CycleClock::from_ns(value.count());
+    }
+
+    // Checks if the time slice is used up or task is terminating, cheap enough to be called in hot loops
+    bool should_yield() const {
+        return state == TaskState::terminating || CycleClock::now() >= slice_end;
+    }
+
     // Allows other tasks to execute
     bool yield();
+
+    // Allows other tasks to execute, switching to target directly if possible
+    // Target is treated as if it was picked by the scheduler
+    bool yield_to(Task& target);
+
+    // Allows other tasks to execute if the time slice is used up and another task may have to run,
+    // see SchedulerBase::has_competition(), otherwise just starts a new time slice
+    inline bool yield_if_needed();
+};
+
+
+// Snapshots of the histograms of a scheduler, see SchedulerBase::get_histograms()
+struct SchedulerHistograms {
+    HistogramSnapshot launch_latency; // From task creation or submission to first run
+    HistogramSnapshot wake_latency; // From being woken up to running again
+    HistogramSnapshot run_time; // Time between switches, including yields that skipped them
+    HistogramSnapshot wait_time; // Time spent parked in waits like those of mutexes
+
+    // Adds histograms of another scheduler
+    SchedulerHistograms& operator +=(const SchedulerHistograms& o) {
+        launch_latency += o.launch_latency;
+        wake_latency += o.wake_latency;
+        run_time += o.run_time;
+        wait_time += o.wait_time;
+        return *this;
+    }
+};
+
+
+// Awaitable counterpart of Task::yield() for stackless tasks
+class YieldAwaiter {
+    Task& task;
+    bool result = true;
+    bool switching = false;
+
+public:
+    YieldAwaiter(Task& task) : task(task) {}
+
+    bool await_ready() {
+        switching = task.prepare_yield(result);
+        return !switching;
+    }
+    template<class Handle>
+    void await_suspend(Handle) {}
+    bool await_resume() {
+        return switching ? task.finish_yield() : result;
+    }
+};
+
+
+// Scheduling policies are plain classes passed to BasicScheduler as template parameter,
+// so all of their hooks can be inlined into the scheduler loop.
+// They are expected to inherit from this class and hide the hooks they need:
+//  - on_create/on_exit: Task has been added to/is about to be removed from the scheduler
+//  - on_ready: Task has become runnable and must be considered by pick_next()
+//  - on_block: Task has stopped being runnable without having been picked
+//  - on_stop: Task picked earlier has handed control back to the scheduler
+//  - on_switch: Task picked earlier has switched to a ready task directly, which counts as picked from now on
+//  - on_pick: Task has been taken out after on_block() to run without pick_next(), it counts as picked from now on
+//  - pick_next: Returns the next task to run and forgets about it, or nullptr
+struct SchedulingPolicy {
+    // Set if a ready task can never be preempted by a ready task of lower priority
+    static constexpr bool strict_priority = false;
+
+    void on_create(Task&) {}
+    void on_exit(Task&) {}
+    void on_ready(Task&) {}
+    void on_block(Task&) {}
+    void on_stop(Task&) {}
+    void on_switch(Task&, Task&) {}
+    void on_pick(Task&) {}
+};
+
+
+// Set of priorities, e.g. those there are ready tasks of
+class PriorityBitmap {
+    std::array<uint64_t, 4> words{};
+
+    static unsigned get_index(Priority priority) {
+        return static_cast<unsigned>(priority + 128);
+    }
+
+public:
+    void set(Priority priority) {
+        const auto idx = get_index(priority);
+        words[idx / 64] |= uint64_t(1) << (idx % 64);
+    }
+    void clear(Priority priority) {
+        const auto idx = get_index(priority);
+        words[idx / 64] &= ~(uint64_t(1) << (idx % 64));
+    }
+
+    bool empty() const {
+        return !(words[0] | words[1] | words[2] | words[3]);
+    }
+
+    // Returns the highest priority in the set, MUST NOT be empty
+    Priority get_highest() const {
+        unsigned word = words.size() - 1;
+        while (!words[word]) word--;
+#ifdef __GNUC__
+        const unsigned bit = 63 - __builtin_clzll(words[word]);
+#else
+        unsigned bit = 63;
+        while (!(words[word] >> bit)) bit--;
+#endif
+        return static_cast<Priority>(int(word * 64 + bit) - 128);
+    }
+
+    // Checks if given priority or a higher one is in the set
+    bool has_at_least(Priority priority) const {
+        const auto idx = get_index(priority);
+        if (words[idx / 64] >> (idx % 64)) return true;
+        for (unsigned word = idx / 64 + 1; word != words.size(); word++) {
+            if (words[word]) return true;
+        }
+        return false;
+    }
+};
+
+
+// Keeps track of the amount of ready tasks per priority
+// Counts are only written from the scheduling thread, but may be read from any thread
+class ReadyIndex {
+    std::array<std::atomic<uint32_t>, 256> counts{};
+    PriorityBitmap bitmap;
+    std::atomic<size_t> total = 0;
+
+    static unsigned get_index(Priority priority) {
+        return static_cast<unsigned>(priority + 128);
+    }
+
+public:
+    void add(Priority priority) {
+        const auto idx = get_index(priority);
+        const auto count = counts[idx].load(std::memory_order_relaxed);
+        counts[idx].store(count + 1, std::memory_order_relaxed);
+        if (count == 0) bitmap.set(priority);
+        total.store(total.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+    void remove(Priority priority) {
+        const auto idx = get_index(priority);
+        const auto count = counts[idx].load(std::memory_order_relaxed) - 1;
+        counts[idx].store(count, std::memory_order_relaxed);
+        if (count == 0) bitmap.clear(priority);
+        total.store(total.load(std::memory_order_relaxed) - 1, std::memory_order_relaxed);
+    }
+
+    // Returns the amount of ready tasks, optionally of given priority only, can be called from any thread
+    size_t size() const {
+        return total.load(std::memory_order_relaxed);
+    }
+    size_t size(Priority priority) const {
+        return counts[get_index(priority)].load(std::memory_order_relaxed);
+    }
+
+    // Returns the highest priority there are ready tasks of, MUST NOT be empty
+    Priority get_highest() const {
+        return bitmap.get_highest();
+    }
+
+    // Checks if there are ready tasks of given priority or higher
+    bool has_at_least(Priority priority) const {
+        return bitmap.has_at_least(priority);
+    }
+};
+
+
+// Strict priority, least recently stopped task first
+class PriorityPolicy : public SchedulingPolicy {
+    // Ready tasks of one priority, ordered by the point in time they've stopped at
+    struct List {
+        Task *first = nullptr;
+        Task *last = nullptr;
+    };
+
+    std::array<List, 256> ready;
+    PriorityBitmap nonempty; // Priorities whose lists aren't empty
+
+    List& get_list(Priority priority) {
+        return ready[static_cast<unsigned>(priority + 128)];
+    }
+
+public:
+    static constexpr bool strict_priority = true;
+
+    void on_ready(Task& task) {
+        task.queued_stopped_at = task.stopped_at;
+        auto& list = get_list(task.queued_priority);
+        // Task has usually stopped most recently so search from the back,
+        // unless it has stopped before all others
+        Task *prev = list.last;
+        if (list.first && task.queued_stopped_at < list.first->queued_stopped_at) prev = nullptr;
+        else while (prev && prev->queued_stopped_at > task.queued_stopped_at) prev = prev->ready_prev;
+        // Insert after it
+        Task *next = prev ? prev->ready_next : list.first;
+        task.ready_prev = prev;
+        task.ready_next = next;
+        (prev ? prev->ready_next : list.first) = &task;
+        (next ? next->ready_prev : list.last) = &task;
+        nonempty.set(task.queued_priority);
+    }
+    void on_block(Task& task) {
+        auto& list = get_list(task.queued_priority);
+        (task.ready_prev ? task.ready_prev->ready_next : list.first) = task.ready_next;
+        (task.ready_next ? task.ready_next->ready_prev : list.last) = task.ready_prev;
+        if (!list.first) nonempty.clear(task.queued_priority);
+    }
+
+    Task *pick_next() {
+        // Get least recently stopped task with highest priority
+        if (nonempty.empty()) return nullptr;
+        Task *fres = get_list(nonempty.get_highest()).first;
+        on_block(*fres);
+        return fres;
+    }
+};
+
+
+// Recycles memory of stackless coroutine frames in size classes
+class FramePool {
+    struct FreeFrame {
+        FreeFrame *next;
+    };
+    // Placed in front of every frame, keeps frame aligned
+    struct alignas(std::max_align_t) Header {
+        FramePool *pool; // nullptr if frame has been allocated outside of a scheduler
+        size_t size_class;
+    };
+
+    static constexpr size_t granularity = 64;
+    std::array<FreeFrame*, 32> free_frames{};
+
+public:
+    FramePool() {}
+    FramePool(const FramePool&) = delete;
+    FramePool(FramePool&&) = delete;
+    ~FramePool();
+
+    // Allocates from pool of the scheduler of the current task if there is one
+    static void *allocate(size_t size);
+    static void deallocate(void *frame);
 };
 
 
-class Scheduler {
+// Caches memory blocks of task arenas
+class ArenaPool {
+    struct FreeBlock {
+        FreeBlock *next;
+    };
+
+    FreeBlock *free_blocks = nullptr;
+    size_t block_size = 64 * 1024;
+    size_t block_count = 0;
+
+public:
+    ArenaPool() {}
+    ArenaPool(const ArenaPool&) = delete;
+    ArenaPool(ArenaPool&&) = delete;
+    ~ArenaPool();
+
+    // Sets the size of blocks, MUST be called before the first block is allocated
+    size_t get_block_size() const {
+        return block_size;
+    }
+    void set_block_size(size_t value) {
+        block_size = value;
+    }
+
+    // Returns the amount of blocks allocated, cached or not
+    size_t get_block_count() const {
+        return block_count;
+    }
+
+    void *allocate();
+    // Takes back a chain of blocks linked through their first word
+    void deallocate(void *first, void *last) {
+        static_cast<FreeBlock*>(last)->next = free_blocks;
+        free_blocks = static_cast<FreeBlock*>(first);
+    }
+};
+
+
+class SchedulerBase {
     friend class Task;
-    friend class TaskPtr;
+    friend class FramePool;
+    friend class TaskArena;
+    friend class Watchdog;
 
+protected:
     std::vector<std::unique_ptr<Task>> tasks;
+    std::vector<Task*> pending; // Tasks whose runnability has changed outside of scheduler context
+    std::vector<Task*> spawned; // Tasks created from within tasks, not known to the policy yet
+    Task *run_next = nullptr; // Task spawned to be run as soon as the spawning task yields
+    unsigned run_next_streak = 0; // Amount of tasks in a row run because of run_next
+    static constexpr unsigned max_run_next_streak = 3; // Policy picks next task once reached, so spawning tasks can't starve others
+    uint64_t next_task_id = 0;
+    ReadyIndex ready_index;
+    uint64_t default_time_slice = CycleClock::from_ns(2000000);
+    bool strict_priority = false; // Ready tasks of lower priority can't take over when set
+    FramePool frame_pool;
+    ArenaPool arena_pool;
+    std::vector<SharedStack> shared_stacks;
+    size_t shared_stack_count = 4, shared_stack_size = 256 * 1024, next_shared_stack = 0;
+    bool stack_watermark = false; // Stacks are filled on launch so peak usage can be measured on exit
+    StackUsageReport stack_usage; // Peak stack usage of exited tasks
+    std::function<void (const Task&, size_t)> stack_peak_hook;
+    std::atomic<size_t> injection_queue_size = 0; // Tasks submitted from other threads not yet created
+    Task *resumed = nullptr; // Task last resumed by the scheduler, may have handed over to Task::current since
+    // Informs the policy about a direct switch between tasks, set by BasicScheduler
+    void (*switch_task)(SchedulerBase& scheduler, Task& from, Task& to) = nullptr;
+
+    // Counters, only written from the scheduling thread
+    std::atomic<uint64_t> switches = 0;
+    std::atomic<uint64_t> skipped_switches = 0;
+    std::atomic<size_t> arena_high_water = 0;
+    std::atomic<uint64_t> tasks_created = 0;
+    std::atomic<uint64_t> tasks_exited = 0;
+    std::atomic<size_t> suspended_tasks = 0;
+    std::atomic<uint64_t> stack_bytes_trimmed = 0;
+    // Busy and idle time, only maintained by ScheduledThread, in cycle clock ticks
+    std::atomic<uint64_t> started_at = 0;
+    std::atomic<uint64_t> idle_since = 0; // 0 while busy
+    std::atomic<uint64_t> idle_time = 0;
+
+    // Histograms, only recorded from the scheduling thread
+    Histogram launch_latency;
+    Histogram wake_latency;
+    Histogram run_time;
+    Histogram wait_time;
+    // Cycle clock tick, 0 while not running any task
+    // Changes on every switch and every yield that skips it, so it is also what Watchdog tells hung tasks by
+    std::atomic<uint64_t> last_resumed_at = 0;
+    TraceBuffer trace_buffer;
+
+    void trace(TraceEventType type, const Task *task, uint64_t now, const void *object = nullptr) {
+        if (trace_buffer.is_enabled()) trace_buffer.record(type, task->id, now, object, type == TraceEventType::spawn ? std::string_view(task->name) : std::string_view());
+    }
+    // Traces task that has stopped running
+    void trace_stop(const Task *task, uint64_t now) {
+        // Exit is traced once task is deleted
+        if (task->state == TaskState::deleting) return;
+        trace(task->is_runnable() ? TraceEventType::yield : TraceEventType::suspend, task, now);
+    }
+
+    // Records histograms and trace of task about to be resumed
+    void record_resume(Task *task, uint64_t now) {
+        trace(TraceEventType::resume, task, now);
+        if (const auto resumed_at = last_resumed_at.load(std::memory_order_relaxed)) run_time.record(now - resumed_at);
+        last_resumed_at.store(now, std::memory_order_relaxed);
+        if (task->submitted_at) {
+            launch_latency.record(now - task->submitted_at);
+            task->submitted_at = 0;
+        }
+        if (task->woken_at) {
+            wake_latency.record(now - task->woken_at);
+            task->woken_at = 0;
+        }
+    }
+    // Records a yield that didn't need to switch like a switch back to the same task, which has given way after all
+    void record_skipped_switch(uint64_t now) {
+        if (const auto resumed_at = last_resumed_at.load(std::memory_order_relaxed)) run_time.record(now - resumed_at);
+        last_resumed_at.store(now, std::memory_order_relaxed);
+    }
+    // Records end of the last run if no task is resumed next
+    void record_stop() {
+        const auto resumed_at = last_resumed_at.load(std::memory_order_relaxed);
+        if (!resumed_at) return;
+        run_time.record(CycleClock::now() - resumed_at);
+        last_resumed_at.store(0, std::memory_order_relaxed);
+    }
+
+    void set_idle(bool value) {
+        const auto now = CycleClock::now();
+        if (value) {
+            idle_since.store(now, std::memory_order_relaxed);
+        } else {
+            idle_time.store(idle_time.load(std::memory_order_relaxed) + now - idle_since.load(std::memory_order_relaxed), std::memory_order_relaxed);
+            idle_since.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    void add_pending(Task *task) {
+        if (task->in_pending) return;
+        task->in_pending = true;
+        pending.push_back(task);
+    }
+
+    void set_queued(Task *task, bool value) {
+        task->queued = value;
+        if (value) ready_index.add(task->queued_priority = task->priority);
+        else ready_index.remove(task->queued_priority);
+#ifdef COSCHED2_TASK_STATS
+        // Requeued tasks stay ready, picked tasks stop being ready once resumed
+        if (value && !task->ready_since) task->ready_since = CycleClock::now();
+#endif
+    }
 
-    void clean_task(Task *task);
+    // Appends return addresses of a task that isn't running, innermost first
+    static void walk_stack(const Task& task, std::vector<uintptr_t>& frames, size_t max_depth);
+
+    Task *add_task(const std::string& name, std::function<void ()>&& start_fcn, const TaskOptions& options);
+    // Destroys locals, coroutine and arena of the task, in that order
+    void free_task(Task *task);
     void delete_task(Task *task);
-    Task *get_next_task();
+    void launch_task(Task *task);
+    void resume_task(Task *task);
 
 public:
-    Scheduler() {}
-    Scheduler(const Scheduler&) = delete;
-    Scheduler(Scheduler&&) = delete;
+    SchedulerBase() {}
+    SchedulerBase(const SchedulerBase&) = delete;
+    SchedulerBase(SchedulerBase&&) = delete;
+    ~SchedulerBase();
+
+    // Creates new task from within a task of this scheduler, without any locking
+    // It is started once picked by the scheduling policy or, if run_next is set, as soon as the
+    // calling task yields unless a task of higher priority is ready
+    Task& spawn(const std::string& name, std::function<void ()>&& start_fcn, const TaskOptions& options = {}, bool run_next = false) {
+        Task *task = add_task(name, std::move(start_fcn), options);
+        spawned.push_back(task);
+        if (run_next) this->run_next = task;
+        return *task;
+    }
 
     // Returns all tasks
     const auto& get_tasks() const {
@@ -147,14 +779,271 @@ public:
         return !tasks.empty();
     }
 
-    // Creates new task, returns it and switches to it
-    // DO NOT call from within a task
-    void create_task(const std::string& name) {
-        // Clean up old task
-        clean_task(Task::current);
+    // Returns the amount of ready tasks per priority
+    const ReadyIndex& get_ready_index() const {
+        return ready_index;
+    }
+
+    // Checks if a task of given priority may have to give way to another task when yielding
+    bool has_competition(Priority priority) const {
+        if (!pending.empty() || !spawned.empty() || injection_queue_size.load(std::memory_order_relaxed)) return true;
+        return strict_priority ? ready_index.has_at_least(priority) : ready_index.size();
+    }
+
+    // Returns the amount of times a task has been resumed and the amount of
+    // yields that returned immediately because no other task was waiting, can be called from any thread
+    uint64_t get_switches() const {
+        return switches.load(std::memory_order_relaxed);
+    }
+    uint64_t get_skipped_switches() const {
+        return skipped_switches.load(std::memory_order_relaxed);
+    }
+
+    // Returns the buffer task switches, spawns and waits are traced into if enabled
+    // See TraceExporter in cosched2/trace.hpp
+    TraceBuffer& get_trace_buffer() {
+        return trace_buffer;
+    }
+    const TraceBuffer& get_trace_buffer() const {
+        return trace_buffer;
+    }
+
+    // Returns snapshots of the histograms without taking any locks, can be called from any thread
+    SchedulerHistograms get_histograms() const {
+        return {launch_latency.get_snapshot(), wake_latency.get_snapshot(), run_time.get_snapshot(), wait_time.get_snapshot()};
+    }
+
+    // Captures the stacks of all tasks that aren't running along with the time they've been parked for
+    // Only walks stacks, symbolizing is left to OffCpuProfile::to_folded(), requires cosched2/off_cpu_profile.hpp
+    // MUST be called from the scheduling thread, e.g. from within a task or a periodic hook
+    OffCpuProfile sample_off_cpu(size_t max_depth = 64) const;
+
+    // Gives the memory of the unused part of the stacks of tasks that have been suspended or parked in a wait
+    // for at least min_parked back to the system, pages are faulted back in as zeros once needed again
+    // With lazy, the system only takes the pages once it runs short on memory (MADV_FREE where supported)
+    // Tasks on shared stacks or with watermarked stacks are skipped, returns the amount of resident bytes given back
+    // MUST be called from the scheduling thread, e.g. from within a task or a periodic hook
+    size_t trim_stacks(std::chrono::nanoseconds min_parked, bool lazy = false);
+
+    // Returns a snapshot of all metrics without taking any locks, can be called from any thread
+    // Requires cosched2/metrics.hpp
+    SchedulerMetrics get_metrics() const;
+
+    // Enables filling the stacks of tasks launched from now on with a pattern, so the deepest they have used
+    // their stack can be measured once they exit, see get_stack_usage() and Task::get_stack_peak()
+    // Meant for sizing stacks, every launch fills the whole stack which makes it resident
+    // Shared stacks are only watermarked if enabled before the first task with shared stack is created
+    void set_stack_watermark(bool value) {
+        stack_watermark = value;
+    }
+    // Sets a function that is passed every watermarked task along with its peak stack usage when it exits
+    void set_stack_peak_hook(std::function<void (const Task&, size_t)>&& hook) {
+        stack_peak_hook = std::move(hook);
+    }
+    // Returns the peak stack usage of exited watermarked tasks by task name
+    // MUST be called from the scheduling thread, e.g. from within a task or a periodic hook
+    const StackUsageReport& get_stack_usage() const {
+        return stack_usage;
+    }
+
+    // Sets the amount and size of stacks shared by tasks created with TaskOptions::shared_stack
+    // Only supported by the native context switch backend, tasks get private stacks otherwise
+    // MUST be called before the first task with shared stack is created
+    void set_shared_stacks(size_t count, size_t size) {
+        shared_stack_count = count;
+        shared_stack_size = size;
+    }
+
+    // Returns the pool task arenas take their blocks from
+    ArenaPool& get_arena_pool() {
+        return arena_pool;
+    }
+    // Returns the most memory any task arena has handed out, can be called from any thread
+    size_t get_arena_high_water() const {
+        return arena_high_water.load(std::memory_order_relaxed);
+    }
+
+    // Sets the time slice of tasks that don't have their own
+    std::chrono::nanoseconds get_default_time_slice() const {
+        return std::chrono::nanoseconds(CycleClock::to_ns(default_time_slice));
+    }
+    void set_default_time_slice(std::chrono::nanoseconds value) {
+        default_time_slice = CycleClock::from_ns(value.count());
+    }
+};
+
+
+inline bool Task::yield_if_needed() {
+    if (!should_yield()) return true;
+    // Just keep going if there is nobody to give the time to
+    if (state != TaskState::terminating && !scheduler->has_competition(priority)) {
+        const auto now = CycleClock::now();
+        slice_end = now + (time_slice ? time_slice : scheduler->default_time_slice);
+        scheduler->record_skipped_switch(now);
+        return true;
+    }
+    return yield();
+}
+
+inline void Task::park(void *wait_object, void (*cancel)(void *wait_object, Task& task)) {
+    this->wait_object = wait_object;
+    wait_cancel = cancel;
+    wait_cancelled = false;
+    parked_at = CycleClock::now();
+    scheduler->trace(TraceEventType::wait, this, parked_at, wait_object);
+    set_suspended(true);
+}
+
+inline void Task::unpark() {
+    const auto now = CycleClock::now();
+    scheduler->trace(TraceEventType::wake, this, now, wait_object);
+    wait_object = nullptr;
+    wait_cancel = nullptr;
+    const auto waited = now - parked_at;
+    scheduler->wait_time.record(waited);
+#ifdef COSCHED2_TASK_STATS
+    stats.wait_time += waited;
+#endif
+    set_suspended(false);
+}
+
+
+template<class Policy = PriorityPolicy>
+class BasicScheduler final : public SchedulerBase {
+    template<class> friend class BasicScheduledThread;
+
+    Policy policy;
+
+    // Informs the policy if task has become (un)runnable
+    void sync_task(Task *task) {
+        const bool runnable = task->is_runnable();
+#ifdef COSCHED2_TASK_STATS
+        if (!runnable && task->ready_since) task->stop_ready(CycleClock::now());
+#endif
+        if (task->requeue) {
+            task->requeue = false;
+            if (task->queued) {
+                set_queued(task, false);
+                policy.on_block(*task);
+            }
+        }
+        if (runnable == task->queued) return;
+        set_queued(task, runnable);
+        if (runnable) policy.on_ready(*task);
+        else policy.on_block(*task);
+    }
+
+    // Makes tasks spawned since known to the policy
+    void add_spawned() {
+        for (auto spawned_task : spawned) {
+            policy.on_create(*spawned_task);
+            sync_task(spawned_task);
+        }
+        spawned.clear();
+    }
 
-        // Create and switch to new task
-        Task::current = tasks.emplace_back(std::make_unique<Task>(this, name)).get();
+    void clean_task(Task *task) {
+        if (!task) return;
+        // Catch up on tasks spawned since, before task is queued again behind them
+        add_spawned();
+        // Task resumed by us may have switched to this one directly
+        if (resumed && resumed != task) policy.on_stop(*resumed);
+        resumed = nullptr;
+        policy.on_stop(*task);
+        // If current task has no way to resume, it is considered a zombie so removed from list
+        if (task->state == TaskState::deleting) {
+            policy.on_exit(*task);
+            // Watchdogs signal handler MUST NOT find the task once it is gone
+            if (Task::current == task) {
+                Task::current = nullptr;
+                std::atomic_signal_fence(std::memory_order_seq_cst);
+            }
+            delete_task(task);
+        } else {
+            sync_task(task);
+        }
+    }
+
+    // Target of a direct switch is taken out of the policy like picked tasks are,
+    // while the switching task is queued again right away as if it had yielded
+    static void switch_task_to(SchedulerBase& scheduler, Task& from, Task& to) {
+        auto& self = static_cast<BasicScheduler&>(scheduler);
+        if (to.queued) {
+            self.set_queued(&to, false);
+            self.policy.on_block(to);
+        }
+        self.policy.on_switch(from, to);
+        self.add_spawned();
+        self.sync_task(&from);
+    }
+
+    Task *get_next_task() {
+        // Catch up on tasks changed from within other tasks
+        for (auto task : pending) {
+            task->in_pending = false;
+            sync_task(task);
+        }
+        pending.clear();
+
+        // Run task spawned to run next if still possible, but not too often in a row so spawning tasks can't starve others
+        if (Task *next_task = run_next) {
+            run_next = nullptr;
+            // Nothing can be of higher priority than the highest one
+            const bool preempted = strict_priority && next_task->priority != INT8_MAX && ready_index.has_at_least(next_task->priority + 1);
+            if (next_task->queued && run_next_streak != max_run_next_streak && !preempted) {
+                run_next_streak++;
+                set_queued(next_task, false);
+                policy.on_block(*next_task);
+                policy.on_pick(*next_task);
+                return next_task;
+            }
+        }
+        run_next_streak = 0;
+
+        // Let policy decide
+        Task *next_task = policy.pick_next();
+        if (next_task) set_queued(next_task, false);
+        return next_task;
+    }
+
+public:
+    BasicScheduler() {
+        strict_priority = Policy::strict_priority;
+        switch_task = switch_task_to;
+    }
+    template<typename... Args>
+    explicit BasicScheduler(Args&&... policy_args) : policy(std::forward<Args>(policy_args)...) {
+        strict_priority = Policy::strict_priority;
+        switch_task = switch_task_to;
+    }
+    // Tasks that haven't finished leave the policy like finished ones, e.g. groups outlive the scheduler
+    ~BasicScheduler() {
+        for (auto& task : tasks) {
+            // Spawned tasks haven't been made known to the policy yet
+            if (std::find(spawned.begin(), spawned.end(), task.get()) != spawned.end()) continue;
+            if (task->queued) {
+                set_queued(task.get(), false);
+                policy.on_block(*task);
+            }
+            policy.on_exit(*task);
+        }
+    }
+
+    // Returns the scheduling policy
+    Policy& get_policy() {
+        return policy;
+    }
+    const Policy& get_policy() const {
+        return policy;
+    }
+
+    // Creates new task and returns it, it is started once picked by the scheduling policy
+    // DO NOT call from within a task, use spawn() there
+    Task& create_task(const std::string& name, std::function<void ()>&& start_fcn, const TaskOptions& options = {}) {
+        Task *task = add_task(name, std::move(start_fcn), options);
+        policy.on_create(*task);
+        sync_task(task);
+        return *task;
     }
 
     // Run until there are no more tasks left to process
@@ -168,7 +1057,30 @@ public:
 
     // Run once
     // DO NOT call from within a task
-    void run_once();
+    void run_once() {
+        // Clean up old task
+        clean_task(Task::current);
+
+        // Get new task
+        Task::current = get_next_task();
+
+        // Start or resume task if any
+        if (!Task::current) {
+            record_stop();
+            return;
+        }
+        if (Task::current->has_context()) resume_task(Task::current);
+        else launch_task(Task::current);
+        if (Task::current && trace_buffer.is_enabled()) trace_stop(Task::current, CycleClock::now());
+#ifdef COSCHED2_TASK_STATS
+        // Task may have switched to another one directly
+        if (Task::current) Task::current->stop_run(CycleClock::now());
+#endif
+    }
 };
+
+using Scheduler = BasicScheduler<>;
+
+extern template class BasicScheduler<PriorityPolicy>;
 }
 #endif // _SCHEDULER_HPP
@@ -2,12 +2,14 @@
 #define SCHEDULER_MUTEX_HPP
 #include "scheduler.hpp"
 
-#include <queue>
+#include <deque>
 
 
 namespace CoSched {
 class [[nodiscard("Discarding the lock guard will release the lock immediately.")]] LockGuard {
     class Mutex *mutex;
+    bool cancelled = false;
+    bool failed = false;
 
     void unlock();
 
@@ -15,7 +17,7 @@ public:
     LockGuard() : mutex(nullptr) {}
     LockGuard(Mutex *m) : mutex(m) {}
     LockGuard(const LockGuard&) = delete;
-    LockGuard(LockGuard&& o) : mutex(o.mutex) {
+    LockGuard(LockGuard&& o) : mutex(o.mutex), cancelled(o.cancelled), failed(o.failed) {
         o.mutex = nullptr;
     }
     ~LockGuard() {
@@ -24,15 +26,46 @@ public:
 
     auto& operator =(LockGuard&& o) {
         mutex = o.mutex;
+        cancelled = o.cancelled;
+        failed = o.failed;
         o.mutex = nullptr;
         return *this;
     }
+
+    // Returns a guard for a lock that hasn't been acquired because the task is being terminated
+    static LockGuard make_cancelled() {
+        LockGuard fres;
+        fres.cancelled = true;
+        return fres;
+    }
+    // Checks if lock hasn't been acquired because the task is being terminated
+    bool is_cancelled() const {
+        return cancelled;
+    }
+
+    // Returns a guard for a lock that hasn't been acquired because it is held and the task can't wait for it
+    static LockGuard make_failed() {
+        LockGuard fres;
+        fres.failed = true;
+        return fres;
+    }
+    // Checks if lock hasn't been acquired because it is held and the task can't wait for it, see TaskOptions::run_inline
+    bool is_failed() const {
+        return failed;
+    }
 };
 
 
 class Mutex {
+    friend class LockAwaiter;
+
     Task *holder = nullptr;
-    std::queue<Task*> resume_on_unlock;
+    std::deque<Task*> resume_on_unlock;
+
+    static void cancel_wait(void *mutex, Task& task) {
+        auto& queue = static_cast<Mutex*>(mutex)->resume_on_unlock;
+        queue.erase(std::find(queue.begin(), queue.end(), &task));
+    }
 
 public:
     Mutex() {}
@@ -51,12 +84,21 @@ public:
             holder = &task;
             return LockGuard(this);
         }
+        // Don't bother waiting if task is being terminated
+        if (task.get_state() == TaskState::terminating || task.is_dead()) return LockGuard::make_cancelled();
+        // Inline tasks can't be suspended, so they can't wait for the lock either
+        if (task.is_inline()) return LockGuard::make_failed();
         // Lock is already being held, add task to queue and suspend until lock is passed
-        resume_on_unlock.push(&task);
-        task.set_suspended(true);
-        task.yield();
+        // Holder is run right away so it can get to releasing the lock
+        resume_on_unlock.push_back(&task);
+        task.park(this, cancel_wait);
+        task.yield_to(*holder);
+        if (task.is_wait_cancelled()) return LockGuard::make_cancelled();
         return LockGuard(this);
     }
+    // Awaitable counterpart of lock() for stackless tasks
+    inline class LockAwaiter lock_async();
+
     bool unlock() {
         auto& task = Task::get_current();
         // Make sure we are actually the ones holding the lock
@@ -68,14 +110,67 @@ public:
         }
         // Something is waiting or the lock to be released, just pass it by.
         auto next_task = resume_on_unlock.front();
-        next_task->set_suspended(false);
+        next_task->unpark();
         holder = next_task;
-        resume_on_unlock.pop();
+        resume_on_unlock.pop_front();
         return true;
     }
 };
 
 
+// Awaitable counterpart of Mutex::lock() for stackless tasks, shares its queue
+class LockAwaiter {
+    Mutex& mutex;
+    Task& task;
+    YieldAwaiter yield;
+    LockGuard guard;
+    bool parked = false;
+
+public:
+    LockAwaiter(Mutex& mutex) : mutex(mutex), task(Task::get_current()), yield(task) {}
+
+    bool await_ready() {
+        // Make sure the lock is not already held by same task
+        if (mutex.holder == &task) return true;
+        // Just hold lock if lock isn't currently being held
+        if (!mutex.holder) {
+            mutex.holder = &task;
+            guard = LockGuard(&mutex);
+            return true;
+        }
+        // Don't bother waiting if task is being terminated
+        if (task.get_state() == TaskState::terminating || task.is_dead()) {
+            guard = LockGuard::make_cancelled();
+            return true;
+        }
+        // Inline tasks can't be suspended, so they can't wait for the lock either
+        if (task.is_inline()) {
+            guard = LockGuard::make_failed();
+            return true;
+        }
+        // Lock is already being held, add task to queue and suspend until lock is passed
+        mutex.resume_on_unlock.push_back(&task);
+        task.park(&mutex, Mutex::cancel_wait);
+        parked = true;
+        return yield.await_ready();
+    }
+    template<class Handle>
+    void await_suspend(Handle) {}
+    LockGuard await_resume() {
+        yield.await_resume();
+        if (!parked) return std::move(guard);
+        // Lock has been passed to us unless wait has been cancelled
+        if (task.is_wait_cancelled()) return LockGuard::make_cancelled();
+        return LockGuard(&mutex);
+    }
+};
+
+
+inline LockAwaiter Mutex::lock_async() {
+    return LockAwaiter(*this);
+}
+
+
 inline void LockGuard::unlock() {
     mutex->unlock();
 }
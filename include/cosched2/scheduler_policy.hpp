@@ -0,0 +1,439 @@
+#ifndef SCHEDULER_POLICY_HPP
+#define SCHEDULER_POLICY_HPP
+#include "scheduler.hpp"
+#include "cycle_clock.hpp"
+
+#include <deque>
+#include <set>
+#include <array>
+#include <atomic>
+
+
+namespace CoSched {
+// Strict FIFO, ignores priorities entirely
+// Since yielding tasks are requeued at the back, this is round-robin as well
+class FifoPolicy : public SchedulingPolicy {
+protected:
+    std::deque<Task*> ready;
+
+public:
+    void on_ready(Task& task) {
+        ready.push_back(&task);
+    }
+    void on_block(Task& task) {
+        ready.erase(std::find(ready.begin(), ready.end(), &task));
+    }
+
+    Task *pick_next() {
+        if (ready.empty()) return nullptr;
+        Task *fres = ready.front();
+        ready.pop_front();
+        return fres;
+    }
+};
+
+using RoundRobinPolicy = FifoPolicy;
+
+
+// Most recently readied task first, keeps caches warm at the expense of fairness
+class LifoPolicy : public FifoPolicy {
+public:
+    Task *pick_next() {
+        if (ready.empty()) return nullptr;
+        Task *fres = ready.back();
+        ready.pop_back();
+        return fres;
+    }
+};
+
+
+constexpr std::array<uint32_t, 256> make_fair_weights() {
+    // Weight doubles every 20 priority levels, PRIO_NORMAL has a weight of 1024
+    std::array<uint32_t, 256> fres{};
+    for (int prio = -128; prio != 128; prio++) {
+        double weight = 1024.0;
+        for (int i = 0; i < (prio < 0 ? -prio : prio); i++) {
+            if (prio < 0) weight /= 1.0352649238413776;
+            else weight *= 1.0352649238413776;
+        }
+        fres[static_cast<uint8_t>(prio)] = static_cast<uint32_t>(weight + 0.5);
+    }
+    return fres;
+}
+
+
+// Accounting shared by the fair policies
+// Tracks the task picked last and charges it its runtime scaled down by the weight of its priority,
+// the policies keep the resulting virtual runtimes in order and follow their minimum
+class FairPolicyBase : public SchedulingPolicy {
+    static constexpr std::array<uint32_t, 256> weights = make_fair_weights();
+
+protected:
+    uint64_t wakeup_credit;
+    uint64_t default_slice; // Time slice of tasks that don't have their own, in cycle clock ticks
+    Task *running = nullptr;
+    uint64_t running_since = 0;
+
+    // Tasks becoming ready after blocking get at most wakeup_credit_ns of head start
+    // New tasks are charged one time slice up front, default_slice_ns if they have none of their own
+    FairPolicyBase(uint64_t wakeup_credit_ns, uint64_t default_slice_ns)
+        : wakeup_credit(CycleClock::from_ns(wakeup_credit_ns)), default_slice(CycleClock::from_ns(default_slice_ns)) {}
+
+    // Returns runtime scaled down by weight, PRIO_NORMAL tasks are charged their actual runtime
+    static uint64_t scale(uint64_t delta, uint32_t weight) {
+        return delta * get_weight(PRIO_NORMAL) / std::max<uint32_t>(weight, 1);
+    }
+
+    // Returns the virtual runtime a new task starts at, a time slice behind the current minimum as if it had just run,
+    // so tasks spawning others can't keep getting ahead of everybody else
+    uint64_t place_new(const Task& task, uint64_t min_vruntime) const {
+        return min_vruntime + scale(task.time_slice ? task.time_slice : default_slice, get_weight(task.priority));
+    }
+    // Returns the virtual runtime a task or group becoming ready continues at
+    // Sleepers may not bank their time off-CPU to monopolize the thread once woken up
+    uint64_t place(uint64_t vruntime, uint64_t min_vruntime) const {
+        if (vruntime + wakeup_credit < min_vruntime) return min_vruntime - wakeup_credit;
+        return vruntime;
+    }
+
+    void start_running(Task& task) {
+        running = &task;
+        running_since = CycleClock::now();
+    }
+    // Charges task if it is the one running, returns the time it has been running for or 0 if it isn't
+    uint64_t stop_running(Task& task) {
+        if (running != &task) return 0;
+        running = nullptr;
+        const uint64_t delta = CycleClock::now() - running_since;
+        task.vruntime += scale(delta, get_weight(task.priority));
+        return delta;
+    }
+
+public:
+    // Returns the weight given to a priority
+    static constexpr uint32_t get_weight(Priority priority) {
+        return weights[static_cast<uint8_t>(priority)];
+    }
+
+    void on_exit(Task& task) {
+        if (running == &task) running = nullptr;
+    }
+};
+
+
+// Weighted fair scheduling in the style of CFS
+// Tasks accumulate runtime scaled down by the weight of their priority (virtual runtime)
+// and the task with the lowest virtual runtime runs next, so every priority gets a CPU share
+// proportional to its weight and no runnable task is starved.
+class FairPolicy : public FairPolicyBase {
+    std::set<std::pair<uint64_t, Task*>> ready;
+    uint64_t min_vruntime = 0;
+
+    void update_min_vruntime() {
+        // Never move backwards, follow the lowest virtual runtime of all runnable tasks
+        uint64_t lowest = running ? running->vruntime : UINT64_MAX;
+        if (!ready.empty()) lowest = std::min(lowest, ready.begin()->first);
+        if (lowest != UINT64_MAX) min_vruntime = std::max(min_vruntime, lowest);
+    }
+
+public:
+    // See FairPolicyBase
+    FairPolicy(uint64_t wakeup_credit_ns = 3000000, uint64_t default_slice_ns = 2000000)
+        : FairPolicyBase(wakeup_credit_ns, default_slice_ns) {}
+
+    // Returns the virtual runtime all ready tasks are placed relative to
+    uint64_t get_min_vruntime() const {
+        return min_vruntime;
+    }
+
+    void on_create(Task& task) {
+        task.vruntime = place_new(task, min_vruntime);
+    }
+    void on_ready(Task& task) {
+        task.vruntime = place(task.vruntime, min_vruntime);
+        ready.emplace(task.vruntime, &task);
+    }
+    void on_block(Task& task) {
+        ready.erase({task.vruntime, &task});
+    }
+    void on_stop(Task& task) {
+        if (stop_running(task)) update_min_vruntime();
+    }
+    void on_switch(Task& from, Task& to) {
+        on_stop(from);
+        start_running(to);
+    }
+    void on_pick(Task& task) {
+        start_running(task);
+        // Tasks created while it runs are placed relative to it
+        update_min_vruntime();
+    }
+
+    Task *pick_next() {
+        if (ready.empty()) return nullptr;
+        auto it = ready.begin();
+        Task *fres = it->second;
+        ready.erase(it);
+        on_pick(*fres);
+        return fres;
+    }
+};
+
+
+enum class DeadlineMissAction {
+    terminate, // Task is terminated and run one last time so it can wind down
+    demote // Task loses its deadline and is scheduled by the best effort policy
+};
+
+// Earliest deadline first scheduling
+// Tasks with a deadline run in deadline order ahead of all other tasks, which are
+// scheduled by the best effort policy given as template parameter.
+template<class BestEffort = PriorityPolicy>
+class DeadlinePolicy : public SchedulingPolicy {
+    using time_point = std::chrono::steady_clock::time_point;
+
+    std::set<std::pair<time_point, Task*>> ready;
+    BestEffort best_effort;
+    DeadlineMissAction miss_action;
+    std::atomic<uint64_t> deadline_misses = 0;
+
+public:
+    template<typename... Args>
+    DeadlinePolicy(DeadlineMissAction miss_action = DeadlineMissAction::demote, Args&&... best_effort_args)
+        : best_effort(std::forward<Args>(best_effort_args)...), miss_action(miss_action) {}
+
+    // Returns the best effort policy
+    BestEffort& get_best_effort_policy() {
+        return best_effort;
+    }
+
+    // Sets what happens to tasks whose deadline has passed before they were run
+    DeadlineMissAction get_miss_action() const {
+        return miss_action;
+    }
+    void set_miss_action(DeadlineMissAction value) {
+        miss_action = value;
+    }
+
+    // Returns the amount of deadlines missed, can be called from any thread
+    uint64_t get_deadline_misses() const {
+        return deadline_misses.load(std::memory_order_relaxed);
+    }
+
+    void on_create(Task& task) {
+        best_effort.on_create(task);
+    }
+    void on_exit(Task& task) {
+        best_effort.on_exit(task);
+    }
+    void on_ready(Task& task) {
+        task.queued_deadline = task.deadline;
+        if (task.has_deadline()) ready.emplace(task.deadline, &task);
+        else best_effort.on_ready(task);
+    }
+    void on_block(Task& task) {
+        if (task.queued_deadline != time_point::max()) ready.erase({task.queued_deadline, &task});
+        else best_effort.on_block(task);
+    }
+    void on_stop(Task& task) {
+        best_effort.on_stop(task);
+    }
+    void on_switch(Task& from, Task& to) {
+        best_effort.on_switch(from, to);
+    }
+    void on_pick(Task& task) {
+        best_effort.on_pick(task);
+    }
+
+    Task *pick_next() {
+        if (!ready.empty()) {
+            const auto now = std::chrono::steady_clock::now();
+            while (!ready.empty()) {
+                auto [deadline, task] = *ready.begin();
+                ready.erase(ready.begin());
+                // Run task if deadline can still be met
+                if (deadline >= now) return task;
+                // Handle missed deadline
+                deadline_misses.fetch_add(1, std::memory_order_relaxed);
+                if (miss_action == DeadlineMissAction::terminate) {
+                    task->terminate();
+                    return task;
+                }
+                task->deadline = task->queued_deadline = time_point::max();
+                best_effort.on_ready(*task);
+            }
+        }
+        return best_effort.pick_next();
+    }
+};
+
+
+// Group of tasks getting a share of CPU time proportional to its weight when scheduled by GroupPolicy
+// Groups may be nested and must outlive all of their tasks and subgroups.
+class TaskGroup {
+    friend class GroupPolicy;
+
+    std::string name;
+    uint32_t shares;
+    TaskGroup *parent;
+
+    // Scheduling state, only accessed from the scheduling thread
+    uint64_t vruntime = 0;
+    uint64_t min_vruntime = 0;
+    std::set<std::pair<uint64_t, Task*>> ready_tasks;
+    std::set<std::pair<uint64_t, TaskGroup*>> ready_groups;
+
+    // Accounting including all subgroups, may be read from any thread
+    std::atomic<uint64_t> runtime = 0;
+    std::atomic<size_t> task_count = 0;
+
+    bool is_empty() const {
+        return ready_tasks.empty() && ready_groups.empty();
+    }
+
+public:
+    // Groups without parent are placed directly below the policies root group
+    TaskGroup(const std::string& name, uint32_t shares = 1024, TaskGroup *parent = nullptr)
+        : name(name), shares(shares), parent(parent) {}
+    TaskGroup(const TaskGroup&) = delete;
+    TaskGroup(TaskGroup&&) = delete;
+
+    const std::string& get_name() const {
+        return name;
+    }
+    TaskGroup *get_parent() const {
+        return parent;
+    }
+
+    // Sets the weight of this group relative to its siblings
+    // DO NOT call from outside of the scheduling thread
+    uint32_t get_shares() const {
+        return shares;
+    }
+    void set_shares(uint32_t value) {
+        shares = value;
+    }
+
+    // Returns the amount of time tasks in this group have been running for
+    uint64_t get_runtime_ns() const {
+        return CycleClock::to_ns(runtime.load(std::memory_order_relaxed));
+    }
+
+    // Returns the amount of tasks currently in this group
+    size_t get_task_count() const {
+        return task_count.load(std::memory_order_relaxed);
+    }
+};
+
+
+// Hierarchical fair share scheduling
+// A group is picked in proportion to its shares among its siblings first, then
+// a task inside of it is picked in proportion to its priority weight as in FairPolicy.
+class GroupPolicy : public FairPolicyBase {
+    TaskGroup root{"root"};
+
+    TaskGroup *get_group(Task& task) {
+        return task.group ? task.group : &root;
+    }
+    TaskGroup *get_parent(TaskGroup *group) {
+        if (group == &root) return nullptr;
+        return group->parent ? group->parent : &root;
+    }
+
+    void enqueue(Task& task) {
+        auto group = get_group(task);
+        task.vruntime = place(task.vruntime, group->min_vruntime);
+        bool was_empty = group->is_empty();
+        group->ready_tasks.emplace(task.vruntime, &task);
+        // Groups that just became runnable need to be queued in their parent
+        while (was_empty) {
+            auto parent = get_parent(group);
+            if (!parent) break;
+            group->vruntime = place(group->vruntime, parent->min_vruntime);
+            was_empty = parent->is_empty();
+            parent->ready_groups.emplace(group->vruntime, group);
+            group = parent;
+        }
+    }
+    void dequeue(Task& task) {
+        auto group = get_group(task);
+        group->ready_tasks.erase({task.vruntime, &task});
+        // Groups that are no longer runnable need to be removed from their parent
+        while (group->is_empty()) {
+            auto parent = get_parent(group);
+            if (!parent) break;
+            parent->ready_groups.erase({group->vruntime, group});
+            group = parent;
+        }
+    }
+
+public:
+    // See FairPolicyBase, groups becoming ready get the same head start as tasks
+    GroupPolicy(uint64_t wakeup_credit_ns = 3000000, uint64_t default_slice_ns = 2000000)
+        : FairPolicyBase(wakeup_credit_ns, default_slice_ns) {}
+
+    // Returns the group all tasks and top-level groups are placed in
+    TaskGroup& get_root_group() {
+        return root;
+    }
+
+    void on_create(Task& task) {
+        for (auto group = get_group(task); group; group = get_parent(group))
+            group->task_count.fetch_add(1, std::memory_order_relaxed);
+        task.vruntime = place_new(task, get_group(task)->min_vruntime);
+    }
+    void on_exit(Task& task) {
+        for (auto group = get_group(task); group; group = get_parent(group))
+            group->task_count.fetch_sub(1, std::memory_order_relaxed);
+        FairPolicyBase::on_exit(task);
+    }
+    void on_ready(Task& task) {
+        enqueue(task);
+    }
+    void on_block(Task& task) {
+        dequeue(task);
+    }
+    void on_stop(Task& task) {
+        // Charge runtime to task and all of its groups, scaled by their weights
+        const uint64_t delta = stop_running(task);
+        if (!delta) return;
+        for (auto group = get_group(task); group; group = get_parent(group)) {
+            group->runtime.fetch_add(delta, std::memory_order_relaxed);
+            auto parent = get_parent(group);
+            if (!parent) break;
+            // Groups currently queued in their parent have to be reordered
+            const bool queued = !group->is_empty();
+            if (queued) parent->ready_groups.erase({group->vruntime, group});
+            group->vruntime += scale(delta, group->shares);
+            if (queued) parent->ready_groups.emplace(group->vruntime, group);
+        }
+    }
+    void on_switch(Task& from, Task& to) {
+        on_stop(from);
+        start_running(to);
+    }
+    void on_pick(Task& task) {
+        start_running(task);
+    }
+
+    Task *pick_next() {
+        // Walk down the groups always taking the entity with the lowest virtual runtime
+        TaskGroup *group = &root;
+        while (!group->is_empty()) {
+            const bool take_task = !group->ready_tasks.empty()
+                    && (group->ready_groups.empty() || group->ready_tasks.begin()->first <= group->ready_groups.begin()->first);
+            const uint64_t lowest = take_task ? group->ready_tasks.begin()->first : group->ready_groups.begin()->first;
+            group->min_vruntime = std::max(group->min_vruntime, lowest);
+            if (take_task) {
+                Task *fres = group->ready_tasks.begin()->second;
+                dequeue(*fres);
+                start_running(*fres);
+                return fres;
+            }
+            group = group->ready_groups.begin()->second;
+        }
+        return nullptr;
+    }
+};
+}
+#endif // SCHEDULER_POLICY_HPP
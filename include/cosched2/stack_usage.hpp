@@ -0,0 +1,65 @@
+#ifndef STACK_USAGE_HPP
+#define STACK_USAGE_HPP
+#include "histogram.hpp"
+
+#include <map>
+#include <string>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+
+namespace CoSched {
+// Peak stack usage of tasks that have exited, in bytes, see SchedulerBase::set_stack_watermark()
+// Peaks are bucketed like histograms are, so percentiles are kept with a relative error of at most 1/16
+class StackUsage {
+    std::map<unsigned, uint64_t> counts; // By HistogramBuckets index, stack peaks tend to cluster so few are used
+    uint64_t count = 0;
+    size_t max = 0;
+
+public:
+    void record(size_t peak) {
+        counts[HistogramBuckets::get_index(peak)]++;
+        count++;
+        if (peak > max) max = peak;
+    }
+
+    // Returns the amount of tasks recorded
+    uint64_t get_count() const {
+        return count;
+    }
+
+    // Returns the deepest any of the tasks has used its stack, exact
+    size_t get_max() const {
+        return max;
+    }
+
+    // Returns the stack usage given fraction (0 to 1) of tasks stayed within
+    size_t get_percentile(double fraction) const {
+        if (!count) return 0;
+        uint64_t rank = static_cast<uint64_t>(fraction * static_cast<double>(count) + 0.5);
+        if (rank == 0) rank = 1;
+        uint64_t seen = 0;
+        for (const auto& [index, bucket_count] : counts) {
+            seen += bucket_count;
+            if (seen >= rank) return std::min<size_t>(HistogramBuckets::get_upper_bound(index), max);
+        }
+        return max;
+    }
+
+    // Adds usage recorded by another scheduler
+    StackUsage& operator +=(const StackUsage& o) {
+        for (const auto& [index, bucket_count] : o.counts) {
+            counts[index] += bucket_count;
+        }
+        count += o.count;
+        if (o.max > max) max = o.max;
+        return *this;
+    }
+};
+
+
+// Stack usage by task name
+using StackUsageReport = std::map<std::string, StackUsage>;
+}
+#endif // STACK_USAGE_HPP
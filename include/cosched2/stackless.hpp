@@ -0,0 +1,80 @@
+#ifndef STACKLESS_HPP
+#define STACKLESS_HPP
+#include "scheduler.hpp"
+
+#if !defined(__cpp_impl_coroutine)
+#   error "cosched2/stackless.hpp requires C++20 coroutines"
+#endif
+
+#include <coroutine>
+#include <exception>
+#include <utility>
+
+
+
+namespace CoSched {
+// Return type of stackless task coroutines, their frames are taken from the schedulers frame pool
+// Stackless tasks are scheduled like any other task but MUST only yield using co_await:
+//  - co_await CoSched::yield() instead of Task::yield()
+//  - co_await mutex.lock_async() instead of Mutex::lock()
+class Stackless {
+public:
+    struct promise_type {
+        Stackless get_return_object() {
+            return Stackless(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+        // Started by the scheduler
+        std::suspend_always initial_suspend() noexcept {
+            return {};
+        }
+        // Destroyed by the scheduler
+        std::suspend_always final_suspend() noexcept {
+            return {};
+        }
+        void return_void() {}
+        void unhandled_exception() {
+            std::terminate();
+        }
+
+        static void *operator new(size_t size) {
+            return FramePool::allocate(size);
+        }
+        static void operator delete(void *frame) {
+            FramePool::deallocate(frame);
+        }
+    };
+
+private:
+    std::coroutine_handle<promise_type> handle;
+
+    explicit Stackless(std::coroutine_handle<promise_type> handle) : handle(handle) {}
+
+public:
+    Stackless(const Stackless&) = delete;
+    Stackless(Stackless&& o) : handle(std::exchange(o.handle, nullptr)) {}
+    ~Stackless() {
+        if (handle) handle.destroy();
+    }
+
+    // Makes task run this coroutine, task MUST NOT have been launched yet
+    void attach(Task& task) {
+        task.frame = std::exchange(handle, nullptr).address();
+        task.frame_resume = [] (void *frame) {
+            auto handle = std::coroutine_handle<>::from_address(frame);
+            handle.resume();
+            return handle.done();
+        };
+        task.frame_destroy = [] (void *frame) {
+            std::coroutine_handle<>::from_address(frame).destroy();
+        };
+    }
+};
+
+
+// Awaitable counterpart of Task::yield() for the current stackless task
+inline
+YieldAwaiter yield() {
+    return YieldAwaiter(Task::get_current());
+}
+}
+#endif // STACKLESS_HPP
@@ -0,0 +1,64 @@
+#ifndef TASK_ARENA_HPP
+#define TASK_ARENA_HPP
+#include "scheduler.hpp"
+
+#include <memory_resource>
+#include <cstdint>
+
+
+namespace CoSched {
+// Bump allocator of a task created with TaskOptions::arena, deallocation is a no-op
+// All memory is given back to the schedulers arena pool at once when the task is deleted
+// Lives at the start of its own first block
+class TaskArena final : public std::pmr::memory_resource {
+    // Placed at the start of every block
+    struct alignas(std::max_align_t) Block {
+        Block *next;
+    };
+    // Placed in front of allocations too large for a block
+    struct alignas(std::max_align_t) LargeBlock {
+        LargeBlock *next;
+    };
+
+    SchedulerBase& scheduler;
+    Block *last_block;
+    LargeBlock *large_blocks = nullptr;
+    char *pos, *end;
+    size_t used = 0;
+
+    TaskArena(SchedulerBase& scheduler, Block *block)
+        : scheduler(scheduler), last_block(block),
+          pos(reinterpret_cast<char*>(this + 1)), end(reinterpret_cast<char*>(block) + scheduler.arena_pool.get_block_size()) {
+        block->next = nullptr;
+    }
+
+    void *allocate_slow(size_t bytes, size_t alignment);
+
+protected:
+    void *do_allocate(size_t bytes, size_t alignment) override {
+        const auto addr = (reinterpret_cast<uintptr_t>(pos) + alignment - 1) & ~uintptr_t(alignment - 1);
+        if (addr + bytes > reinterpret_cast<uintptr_t>(end)) return allocate_slow(bytes, alignment);
+        used += addr + bytes - reinterpret_cast<uintptr_t>(pos);
+        pos = reinterpret_cast<char*>(addr + bytes);
+        return pos - bytes;
+    }
+    void do_deallocate(void *, size_t, size_t) override {}
+    bool do_is_equal(const std::pmr::memory_resource& o) const noexcept override {
+        return this == &o;
+    }
+
+public:
+    TaskArena(const TaskArena&) = delete;
+    TaskArena(TaskArena&&) = delete;
+
+    // MUST be called from the scheduling thread
+    static TaskArena *create(SchedulerBase& scheduler);
+    void destroy();
+
+    // Returns the amount of bytes handed out, including alignment padding
+    size_t get_used() const {
+        return used;
+    }
+};
+}
+#endif // TASK_ARENA_HPP
@@ -0,0 +1,109 @@
+#ifndef TASK_SCOPE_HPP
+#define TASK_SCOPE_HPP
+#include "scheduler.hpp"
+
+#include <vector>
+#include <algorithm>
+
+
+namespace CoSched {
+// Bookkeeping of a TaskScope, kept on the heap since its tasks reach it from outside the owning task,
+// whose stack may be shared and not resident by then
+// Freed once the scope and all of its tasks are gone
+class TaskScopeState {
+    friend class Task;
+    friend class SchedulerBase;
+    friend class TaskScope;
+
+    Task& owner;
+    TaskScopeState *outer; // Scope owned by same task this one has been created in
+    std::vector<Task*> tasks;
+    unsigned references = 1; // Held by the scope and each of its tasks
+    bool cancelled = false;
+    bool waiting = false;
+
+    explicit TaskScopeState(Task& owner) : owner(owner), outer(owner.owned_scope) {}
+
+    void release() {
+        if (--references == 0) delete this;
+    }
+
+    void add(Task *task) {
+        task->scope = this;
+        tasks.push_back(task);
+        references++;
+    }
+    void remove(Task *task) {
+        tasks.erase(std::find(tasks.begin(), tasks.end(), task));
+        // Wake up owner once last task is gone
+        if (waiting && tasks.empty()) {
+            waiting = false;
+            owner.set_suspended(false);
+        }
+        release();
+    }
+
+    void cancel() {
+        cancelled = true;
+        for (auto task : tasks) {
+            task->terminate();
+        }
+    }
+};
+
+// Owns tasks spawned through it and waits for all of them to finish when leaving the scope
+// Cancelling a scope terminates all of its tasks, including the tasks in scopes owned by those,
+// and terminating the owning task cancels the scope
+// MUST be created and destroyed from within the same stackful task
+class TaskScope {
+    TaskScopeState *state;
+
+public:
+    TaskScope() : state(new TaskScopeState(Task::get_current())) {
+        state->owner.owned_scope = state;
+        if (state->owner.get_state() == TaskState::terminating || state->owner.is_dead()) state->cancelled = true;
+    }
+    TaskScope(const TaskScope&) = delete;
+    TaskScope(TaskScope&&) = delete;
+    ~TaskScope() {
+        wait();
+        state->owner.owned_scope = state->outer;
+        state->release();
+    }
+
+    // Creates new task in this scope, see SchedulerBase::spawn()
+    Task& spawn(const std::string& name, std::function<void ()>&& start_fcn, const TaskOptions& options = {}, bool run_next = false) {
+        auto& task = state->owner.get_scheduler().spawn(name, std::move(start_fcn), options, run_next);
+        state->add(&task);
+        if (state->cancelled) task.terminate();
+        return task;
+    }
+
+    // Terminates all tasks in this scope, including tasks spawned into it later on
+    void cancel() {
+        state->cancel();
+    }
+    bool is_cancelled() const {
+        return state->cancelled;
+    }
+
+    // Returns the tasks that haven't finished yet
+    const std::vector<Task*>& get_tasks() const {
+        return state->tasks;
+    }
+
+    // Waits for all tasks in this scope to finish, even if owner is being terminated
+    // MUST be called from owning task
+    void wait() {
+        auto& owner = state->owner;
+        while (!state->tasks.empty()) {
+            // Tasks go down along with owner
+            if (!state->cancelled && (owner.get_state() == TaskState::terminating || owner.is_dead())) cancel();
+            state->waiting = true;
+            owner.set_suspended(true);
+            owner.wait_resumed();
+        }
+    }
+};
+}
+#endif // TASK_SCOPE_HPP
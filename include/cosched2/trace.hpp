@@ -0,0 +1,40 @@
+#ifndef TRACE_HPP
+#define TRACE_HPP
+#include "scheduler.hpp"
+
+#include <string>
+#include <vector>
+
+
+namespace CoSched {
+// Renders the trace buffers of schedulers, typically one per ScheduledThread, as Chrome trace event JSON
+// Output can be opened in ui.perfetto.dev or chrome://tracing, every scheduler is shown as a thread
+// Rendering can be done from any thread, even while tracing is enabled, and never takes any of the schedulers locks
+class TraceExporter {
+    struct Source {
+        std::string name;
+        SchedulerBase *scheduler;
+    };
+
+    std::vector<Source> sources;
+
+public:
+    // Adds a scheduler, its events are shown on a thread of given name
+    // MUST NOT be called while rendering, scheduler MUST outlive the exporter
+    void add(const std::string& name, SchedulerBase& scheduler) {
+        sources.push_back({name, &scheduler});
+    }
+
+    // Enables or disables tracing of all schedulers added
+    void set_enabled(bool value) {
+        for (const auto& source : sources) {
+            source.scheduler->get_trace_buffer().set_enabled(value);
+        }
+    }
+
+    std::string render() const;
+    // Writes rendered trace to a file, returns false on failure
+    bool write(const std::string& path) const;
+};
+}
+#endif // TRACE_HPP
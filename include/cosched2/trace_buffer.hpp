@@ -0,0 +1,122 @@
+#ifndef TRACE_BUFFER_HPP
+#define TRACE_BUFFER_HPP
+#include <atomic>
+#include <algorithm>
+#include <memory>
+#include <vector>
+#include <string_view>
+#include <cstdint>
+#include <cstring>
+
+
+namespace CoSched {
+enum class TraceEventType : uint8_t {
+    spawn, // Task has been created
+    resume, // Task has started running
+    yield, // Task has stopped running but is still runnable
+    suspend, // Task has stopped running and isn't runnable
+    wait, // Task has been parked in a wait, e.g. for a mutex
+    wake, // Task has been woken up from a wait, for mutexes the lock has been passed to it
+    exit // Task has finished or has been killed
+};
+
+
+// Trace event as read back from a TraceBuffer
+struct TraceEvent {
+    uint64_t timestamp; // Cycle clock tick
+    uint64_t task_id;
+    uintptr_t object; // Object waited on for wait and wake events
+    TraceEventType type;
+    char name[17]; // Task name for spawn events, truncated
+};
+
+
+// Ring buffer of trace events of one scheduler, the oldest events are overwritten once it is full
+// Recording is lock free but MUST only be done from one thread, snapshots can be taken from any thread
+class TraceBuffer {
+    // Relaxed atomics so slots can be read while being overwritten, torn reads are detected through begin
+    struct Slot {
+        std::atomic<uint64_t> timestamp, task_id, object, type;
+        std::atomic<uint64_t> name[2];
+    };
+
+    std::unique_ptr<Slot[]> slots;
+    size_t capacity = 64 * 1024; // Power of two
+    std::atomic<uint64_t> begin = 0; // Amount of events that have started to be written
+    std::atomic<uint64_t> head = 0; // Amount of events that have been written
+    std::atomic<bool> enabled = false;
+
+public:
+    TraceBuffer() {}
+    TraceBuffer(const TraceBuffer&) = delete;
+    TraceBuffer(TraceBuffer&&) = delete;
+
+    // Sets the amount of events kept, rounded up to a power of two
+    // MUST be called before tracing is enabled for the first time
+    void set_capacity(size_t events) {
+        capacity = 1;
+        while (capacity < events) capacity <<= 1;
+    }
+    size_t get_capacity() const {
+        return capacity;
+    }
+
+    // Enables or disables recording, memory is allocated when first enabled
+    // Can be called from any thread, but not from multiple threads at once
+    void set_enabled(bool value) {
+        if (value && !slots) slots = std::make_unique<Slot[]>(capacity);
+        enabled.store(value, std::memory_order_release);
+    }
+    bool is_enabled() const {
+        return enabled.load(std::memory_order_acquire);
+    }
+
+    // Records an event, tracing MUST be enabled
+    void record(TraceEventType type, uint64_t task_id, uint64_t timestamp, const void *object = nullptr, std::string_view name = {}) {
+        const auto index = head.load(std::memory_order_relaxed);
+        begin.store(index + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        auto& slot = slots[index & (capacity - 1)];
+        slot.timestamp.store(timestamp, std::memory_order_relaxed);
+        slot.task_id.store(task_id, std::memory_order_relaxed);
+        slot.object.store(reinterpret_cast<uintptr_t>(object), std::memory_order_relaxed);
+        slot.type.store(static_cast<uint64_t>(type), std::memory_order_relaxed);
+        if (type == TraceEventType::spawn) {
+            uint64_t words[2] = {};
+            std::memcpy(words, name.data(), std::min(name.size(), sizeof(words)));
+            slot.name[0].store(words[0], std::memory_order_relaxed);
+            slot.name[1].store(words[1], std::memory_order_relaxed);
+        }
+        head.store(index + 1, std::memory_order_release);
+    }
+
+    // Returns the events currently in the buffer, oldest first
+    std::vector<TraceEvent> get_events() const {
+        std::vector<TraceEvent> fres;
+        if (!slots) return fres;
+        const auto end = head.load(std::memory_order_acquire);
+        const auto start = end > capacity ? end - capacity : 0;
+        fres.reserve(end - start);
+        for (auto index = start; index != end; index++) {
+            const auto& slot = slots[index & (capacity - 1)];
+            TraceEvent event{};
+            event.timestamp = slot.timestamp.load(std::memory_order_relaxed);
+            event.task_id = slot.task_id.load(std::memory_order_relaxed);
+            event.object = slot.object.load(std::memory_order_relaxed);
+            event.type = static_cast<TraceEventType>(slot.type.load(std::memory_order_relaxed));
+            if (event.type == TraceEventType::spawn) {
+                const uint64_t words[2] = {slot.name[0].load(std::memory_order_relaxed), slot.name[1].load(std::memory_order_relaxed)};
+                std::memcpy(event.name, words, sizeof(words));
+            }
+            fres.push_back(event);
+        }
+        // Drop events that may have been overwritten while being read
+        std::atomic_thread_fence(std::memory_order_acquire);
+        const auto overwritten_end = begin.load(std::memory_order_relaxed);
+        if (overwritten_end > capacity && overwritten_end - capacity > start)
+            fres.erase(fres.begin(), fres.begin() + std::min<uint64_t>(overwritten_end - capacity - start, fres.size()));
+        return fres;
+    }
+};
+}
+#endif // TRACE_BUFFER_HPP
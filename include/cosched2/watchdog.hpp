@@ -0,0 +1,92 @@
+#ifndef WATCHDOG_HPP
+#define WATCHDOG_HPP
+#include "scheduler.hpp"
+#include "scheduled_thread.hpp"
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <cstdint>
+
+
+namespace CoSched {
+// Task that has kept its scheduling thread from switching for longer than the watchdogs threshold
+struct HungTaskReport {
+    std::string scheduler; // Name the scheduler has been added to the watchdog with
+    bool in_task = false; // Thread has been stuck in a task, otherwise outside of any, e.g. in a periodic hook, or capturing failed
+    uint64_t task_id = 0;
+    std::string task_name;
+    Priority priority = PRIO_NORMAL;
+    std::chrono::nanoseconds running_for{0}; // Time since the scheduler has last switched
+    std::vector<uintptr_t> frames; // Return addresses of the scheduling thread, innermost first, empty if not captured
+
+    // Returns the report along with the symbolized backtrace, one frame per line
+    std::string to_string() const;
+};
+
+
+// Thread watching schedulers for tasks that run for too long without yielding
+// Schedulers only store the time of every switch, the watchdog polls those and interrupts scheduling threads
+// that haven't switched for longer than the threshold with a signal to capture what they are running
+// Backtraces are walked along frame pointers, so code MUST be compiled with -fno-omit-frame-pointer for complete ones
+class Watchdog {
+    struct Source {
+        std::string name;
+        SchedulerBase *scheduler;
+        std::thread::native_handle_type thread;
+        uint64_t reported_resume = 0; // Switch last reported, every hang is reported once only
+    };
+
+    std::vector<Source> sources;
+    std::function<void (const HungTaskReport&)> hook;
+    uint64_t threshold; // In cycle clock ticks
+    std::chrono::nanoseconds interval;
+    int signal;
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable stop_condition;
+    bool stop_requested = false;
+
+    // Captures the running task into the pending capture, runs on the interrupted scheduling thread
+    static void handle_signal(void *ucontext);
+    bool capture(Source& source, HungTaskReport& report);
+    void check(Source& source);
+    void main_loop();
+
+public:
+    // Hung tasks are passed to hook from the watchdog thread, they're written to stderr if none is given
+    explicit Watchdog(std::chrono::nanoseconds threshold, std::function<void (const HungTaskReport&)>&& hook = {});
+    Watchdog(const Watchdog&) = delete;
+    Watchdog(Watchdog&&) = delete;
+    ~Watchdog() {
+        stop();
+    }
+
+    // Sets the signal scheduling threads are interrupted with, SIGURG by default
+    // Its handler is installed process wide once started, so it MUST NOT be used for anything else
+    // MUST NOT be called after having been started
+    void set_signal(int value) {
+        signal = value;
+    }
+
+    // Adds a scheduler run by given thread, its hangs are reported under given name
+    // MUST NOT be called after having been started, scheduler and thread MUST outlive the watchdog
+    void add(const std::string& name, SchedulerBase& scheduler, std::thread::native_handle_type thread) {
+        sources.push_back({name, &scheduler, thread});
+    }
+    // Thread MUST already be running
+    template<class Policy>
+    void add(const std::string& name, BasicScheduledThread<Policy>& thread) {
+        add(name, thread.get_scheduler(), thread.get_native_handle());
+    }
+
+    void start();
+    // Stops the watchdog thread, can be called multiple times
+    void stop();
+};
+}
+#endif // WATCHDOG_HPP
@@ -0,0 +1,190 @@
+#include "cosched2/metrics.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+
+
+
+namespace CoSched {
+SchedulerMetrics SchedulerBase::get_metrics() const {
+    SchedulerMetrics fres;
+    fres.taken_at = std::chrono::steady_clock::now();
+    fres.injection_queue_size = injection_queue_size.load(std::memory_order_relaxed);
+    for (int priority = -128; priority != 128; priority++) {
+        if (const auto count = ready_index.size(static_cast<Priority>(priority)))
+            fres.ready_tasks[static_cast<Priority>(priority)] = count;
+    }
+    // Relaxed loads may be reordered, so there can appear to be more exited tasks than created ones
+    fres.tasks_exited = tasks_exited.load(std::memory_order_relaxed);
+    fres.tasks_created = tasks_created.load(std::memory_order_relaxed);
+    fres.tasks = fres.tasks_created > fres.tasks_exited ? fres.tasks_created - fres.tasks_exited : 0;
+    fres.suspended_tasks = suspended_tasks.load(std::memory_order_relaxed);
+    fres.arena_high_water = arena_high_water.load(std::memory_order_relaxed);
+    fres.switches = switches.load(std::memory_order_relaxed);
+    fres.skipped_switches = skipped_switches.load(std::memory_order_relaxed);
+    fres.stack_bytes_trimmed = stack_bytes_trimmed.load(std::memory_order_relaxed);
+    if (const auto started = started_at.load(std::memory_order_relaxed)) {
+        const auto now = CycleClock::now();
+        uint64_t idle = idle_time.load(std::memory_order_relaxed);
+        if (const auto since = idle_since.load(std::memory_order_relaxed)) idle += now - since;
+        const uint64_t total = now - started;
+        idle = std::min(idle, total);
+        fres.idle_time = std::chrono::nanoseconds(CycleClock::to_ns(idle));
+        fres.busy_time = std::chrono::nanoseconds(CycleClock::to_ns(total - idle));
+    }
+    return fres;
+}
+
+
+size_t SchedulerMetrics::get_ready_tasks() const {
+    size_t fres = 0;
+    for (const auto& [priority, count] : ready_tasks) {
+        fres += count;
+    }
+    return fres;
+}
+
+double SchedulerMetrics::get_rate(uint64_t SchedulerMetrics::*counter, const SchedulerMetrics& earlier) const {
+    const double seconds = std::chrono::duration<double>(taken_at - earlier.taken_at).count();
+    if (seconds <= 0.0) return 0.0;
+    return static_cast<double>(this->*counter - earlier.*counter) / seconds;
+}
+
+SchedulerMetrics& SchedulerMetrics::operator +=(const SchedulerMetrics& o) {
+    taken_at = std::max(taken_at, o.taken_at);
+    injection_queue_size += o.injection_queue_size;
+    for (const auto& [priority, count] : o.ready_tasks) {
+        ready_tasks[priority] += count;
+    }
+    tasks += o.tasks;
+    suspended_tasks += o.suspended_tasks;
+    arena_high_water = std::max(arena_high_water, o.arena_high_water);
+    switches += o.switches;
+    skipped_switches += o.skipped_switches;
+    tasks_created += o.tasks_created;
+    tasks_exited += o.tasks_exited;
+    stack_bytes_trimmed += o.stack_bytes_trimmed;
+    busy_time += o.busy_time;
+    idle_time += o.idle_time;
+    return *this;
+}
+
+
+std::vector<std::pair<std::string, SchedulerMetrics>> MetricsExporter::collect() const {
+    std::vector<std::pair<std::string, SchedulerMetrics>> fres;
+    fres.reserve(sources.size());
+    for (const auto& source : sources) {
+        fres.emplace_back(source.name, source.scheduler->get_metrics());
+    }
+    return fres;
+}
+
+SchedulerMetrics MetricsExporter::get_total() const {
+    SchedulerMetrics fres;
+    for (const auto& source : sources) {
+        fres += source.scheduler->get_metrics();
+    }
+    return fres;
+}
+
+namespace {
+void append_label_value(std::string& out, const std::string& value) {
+    for (const char c : value) {
+        switch (c) {
+        case '\\': out += "\\\\"; break;
+        case '"': out += "\\\""; break;
+        case '\n': out += "\\n"; break;
+        default: out += c;
+        }
+    }
+}
+
+std::string format_seconds(std::chrono::nanoseconds value) {
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "%.9f", std::chrono::duration<double>(value).count());
+    return buf;
+}
+}
+
+std::string MetricsExporter::render() const {
+    const auto snapshots = collect();
+    std::string fres;
+    // Adds a metric family with one sample per scheduler
+    const auto add_family = [&] (const char *name, const char *type, const char *help, auto get_value) {
+        fres += "# HELP "; fres += prefix; fres += name; fres += ' '; fres += help; fres += '\n';
+        fres += "# TYPE "; fres += prefix; fres += name; fres += ' '; fres += type; fres += '\n';
+        for (const auto& [scheduler, metrics] : snapshots) {
+            fres += prefix; fres += name; fres += "{scheduler=\"";
+            append_label_value(fres, scheduler);
+            fres += "\"} "; fres += get_value(metrics); fres += '\n';
+        }
+    };
+    using M = SchedulerMetrics;
+    add_family("injection_queue_depth", "gauge", "Tasks submitted from other threads not created yet.", [] (const M& m) {return std::to_string(m.injection_queue_size);});
+    // Ready tasks are labeled by priority in addition
+    fres += "# HELP "; fres += prefix; fres += "ready_tasks Tasks ready to run by priority.\n";
+    fres += "# TYPE "; fres += prefix; fres += "ready_tasks gauge\n";
+    for (const auto& [scheduler, metrics] : snapshots) {
+        for (const auto& [priority, count] : metrics.ready_tasks) {
+            fres += prefix; fres += "ready_tasks{scheduler=\"";
+            append_label_value(fres, scheduler);
+            fres += "\",priority=\""; fres += std::to_string(priority); fres += "\"} ";
+            fres += std::to_string(count); fres += '\n';
+        }
+    }
+    add_family("tasks", "gauge", "Tasks known to the scheduler.", [] (const M& m) {return std::to_string(m.tasks);});
+    add_family("suspended_tasks", "gauge", "Tasks suspended or parked in a wait.", [] (const M& m) {return std::to_string(m.suspended_tasks);});
+    add_family("arena_high_water_bytes", "gauge", "Most memory any task arena has handed out.", [] (const M& m) {return std::to_string(m.arena_high_water);});
+    add_family("switches_total", "counter", "Times a task has been resumed.", [] (const M& m) {return std::to_string(m.switches);});
+    add_family("skipped_switches_total", "counter", "Yields that returned immediately because no other task was waiting.", [] (const M& m) {return std::to_string(m.skipped_switches);});
+    add_family("tasks_created_total", "counter", "Tasks created.", [] (const M& m) {return std::to_string(m.tasks_created);});
+    add_family("tasks_exited_total", "counter", "Tasks that have finished or have been killed.", [] (const M& m) {return std::to_string(m.tasks_exited);});
+    add_family("stack_trimmed_bytes_total", "counter", "Resident stack memory of long parked tasks given back to the system.", [] (const M& m) {return std::to_string(m.stack_bytes_trimmed);});
+    add_family("busy_seconds_total", "counter", "Time the scheduling thread has spent running tasks.", [] (const M& m) {return format_seconds(m.busy_time);});
+    add_family("idle_seconds_total", "counter", "Time the scheduling thread has spent waiting for work.", [] (const M& m) {return format_seconds(m.idle_time);});
+    // Histograms are rendered as summaries
+    std::vector<SchedulerHistograms> histograms;
+    histograms.reserve(sources.size());
+    for (const auto& source : sources) {
+        histograms.push_back(source.scheduler->get_histograms());
+    }
+    const auto add_summary = [&] (const char *name, const char *help, HistogramSnapshot SchedulerHistograms::*histogram) {
+        fres += "# HELP "; fres += prefix; fres += name; fres += ' '; fres += help; fres += '\n';
+        fres += "# TYPE "; fres += prefix; fres += name; fres += " summary\n";
+        for (size_t index = 0; index != sources.size(); index++) {
+            const auto& snapshot = histograms[index].*histogram;
+            const auto add_sample = [&] (const char *suffix, const char *quantile, const std::string& value) {
+                fres += prefix; fres += name; fres += suffix; fres += "{scheduler=\"";
+                append_label_value(fres, sources[index].name);
+                fres += '"';
+                if (quantile) {
+                    fres += ",quantile=\""; fres += quantile; fres += '"';
+                }
+                fres += "} "; fres += value; fres += '\n';
+            };
+            for (const auto& [quantile, fraction] : {std::pair{"0.5", 0.5}, {"0.9", 0.9}, {"0.99", 0.99}, {"0.999", 0.999}}) {
+                add_sample("", quantile, format_seconds(snapshot.get_percentile(fraction)));
+            }
+            add_sample("_sum", nullptr, format_seconds(snapshot.get_sum()));
+            add_sample("_count", nullptr, std::to_string(snapshot.get_count()));
+        }
+    };
+    add_summary("launch_latency_seconds", "Time from task creation or submission to first run.", &SchedulerHistograms::launch_latency);
+    add_summary("wake_latency_seconds", "Time from a task being woken up to it running again.", &SchedulerHistograms::wake_latency);
+    add_summary("run_time_seconds", "Time between switches, including yields that skipped them.", &SchedulerHistograms::run_time);
+    add_summary("wait_time_seconds", "Time tasks spent parked in waits like those of mutexes.", &SchedulerHistograms::wait_time);
+    return fres;
+}
+
+bool MetricsExporter::write(const std::string& path) const {
+    const auto tmp_path = path + ".tmp";
+    {
+        std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+        if (!out) return false;
+        out << render();
+        if (!out.flush()) return false;
+    }
+    return std::rename(tmp_path.c_str(), path.c_str()) == 0;
+}
+}
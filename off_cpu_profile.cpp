@@ -0,0 +1,95 @@
+#include "cosched2/off_cpu_profile.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <unordered_map>
+#if __has_include(<dlfcn.h>)
+#   include <dlfcn.h>
+#   define COSCHED2_HAS_DLADDR
+#endif
+#if __has_include(<cxxabi.h>)
+#   include <cxxabi.h>
+#   define COSCHED2_HAS_DEMANGLE
+#endif
+
+
+
+namespace CoSched {
+std::string symbolize_address(uintptr_t address) {
+    char buf[32];
+#ifdef COSCHED2_HAS_DLADDR
+    // Return addresses point behind the call, look up the call itself
+    Dl_info info;
+    if (address && dladdr(reinterpret_cast<void*>(address - 1), &info)) {
+        if (info.dli_sname) {
+            std::string fres = info.dli_sname;
+#ifdef COSCHED2_HAS_DEMANGLE
+            int status;
+            if (char *demangled = abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status)) {
+                fres = demangled;
+                std::free(demangled);
+            }
+#endif
+            // Semicolons separate frames in folded stacks
+            std::replace(fres.begin(), fres.end(), ';', ':');
+            return fres;
+        }
+        if (info.dli_fname) {
+            std::string fres = info.dli_fname;
+            fres.erase(0, fres.rfind('/') + 1);
+            std::snprintf(buf, sizeof(buf), "+0x%llx", static_cast<unsigned long long>(address - reinterpret_cast<uintptr_t>(info.dli_fbase)));
+            return fres + buf;
+        }
+    }
+#endif
+    std::snprintf(buf, sizeof(buf), "0x%llx", static_cast<unsigned long long>(address));
+    return buf;
+}
+
+std::string OffCpuProfile::to_folded(bool by_task_name) const {
+    std::unordered_map<uintptr_t, std::string> symbols;
+    std::map<std::string, uint64_t> stacks;
+    for (const auto& sample : samples) {
+        std::string stack = sample.suspended ? "[suspended]" : "[ready]";
+        if (by_task_name) {
+            auto name = sample.task_name;
+            std::replace(name.begin(), name.end(), ';', ':');
+            stack += ';';
+            stack += name;
+        }
+        switch (sample.kind) {
+        case Kind::stackless: stack += ";[stackless]"; break;
+        case Kind::not_started: stack += ";[not started]"; break;
+        case Kind::stackful: break;
+        }
+        // Folded stacks start at the root
+        for (size_t index = sample.frame_count; index-- != 0;) {
+            const auto address = frames[sample.first_frame + index];
+            auto res = symbols.find(address);
+            if (res == symbols.end()) res = symbols.emplace(address, symbolize_address(address)).first;
+            stack += ';';
+            stack += res->second;
+        }
+        const auto us = std::chrono::duration_cast<std::chrono::microseconds>(sample.parked_for).count();
+        stacks[stack] += std::max<uint64_t>(us, 1);
+    }
+    std::string fres;
+    for (const auto& [stack, weight] : stacks) {
+        fres += stack;
+        fres += ' ';
+        fres += std::to_string(weight);
+        fres += '\n';
+    }
+    return fres;
+}
+
+bool OffCpuProfile::write_folded(const std::string& path, bool by_task_name) const {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out) return false;
+    out << to_folded(by_task_name);
+    return static_cast<bool>(out.flush());
+}
+}
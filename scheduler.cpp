@@ -1,13 +1,77 @@
 #include "cosched2/scheduler.hpp"
+#include "cosched2/task_scope.hpp"
+#include "cosched2/task_arena.hpp"
+#include "cosched2/off_cpu_profile.hpp"
 #define MINICORO_IMPL
 #include "minicoro.h"
 
-#include <limits>
 #include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#if __has_include(<sys/mman.h>) && __has_include(<unistd.h>)
+#   include <sys/mman.h>
+#   include <unistd.h>
+#   define COSCHED2_HAS_MADVISE
+#endif
+
+// Native context switches can't be tracked by sanitizers, use minicoro for them
+#if defined(COSCHED2_NATIVE_CONTEXT) && defined(COSCHED2_HAS_NATIVE_CONTEXT) && !defined(_MCO_USE_ASAN) && !defined(_MCO_USE_TSAN)
+#   define COSCHED2_USE_NATIVE_CONTEXT
+#endif
+
+// Direct switches between coroutines need to patch up minicoros context,
+// which is only possible for the plain assembly backend
+#if defined(COSCHED2_USE_NATIVE_CONTEXT) || (defined(MCO_USE_ASM) && !defined(_MCO_USE_ASAN) && !defined(_MCO_USE_TSAN) && !defined(MCO_USE_VALGRIND))
+#   define COSCHED2_DIRECT_SWITCH
+#endif
 
 
 
 namespace CoSched {
+// Byte watermarked stacks are filled with
+static constexpr unsigned char stack_fill = 0xCD;
+
+// Returns how many bytes at the top of a watermarked stack have been written to
+static size_t measure_stack(const void *stack, size_t size) {
+    const auto begin = static_cast<const unsigned char*>(stack);
+    return begin + size - std::find_if(begin, begin + size, [] (unsigned char c) {return c != stack_fill;});
+}
+
+
+#ifdef COSCHED2_USE_NATIVE_CONTEXT
+// Stack pointer of the scheduler that is currently running a task on this thread
+static thread_local void *scheduler_sp;
+
+
+// Copies task stack into its shared stack if another task has been using it since
+// MUST NOT be called while running on that shared stack
+static void make_resident(NativeContext& context) {
+    auto stack = context.shared_stack;
+    if (!stack || stack->owner == &context) return;
+    auto top = reinterpret_cast<char*>(stack->memory) + stack->size;
+    const size_t touched = stack->watermarked ? measure_stack(stack->memory, stack->size) : 0;
+    // Copy used part of current owners stack out
+    if (auto owner = stack->owner) {
+        if (touched > owner->stack_peak) owner->stack_peak = touched;
+        const size_t used = top - reinterpret_cast<char*>(owner->sp);
+        if (owner->save_capacity < used || owner->save_capacity > used * 2) {
+            std::free(owner->save_buffer);
+            owner->save_buffer = std::malloc(used);
+            owner->save_capacity = used;
+        }
+        std::memcpy(owner->save_buffer, owner->sp, used);
+        owner->save_size = used;
+    }
+    // Copy own stack in
+    if (context.save_size) std::memcpy(top - context.save_size, context.save_buffer, context.save_size);
+    // Refill what other tasks have left behind below our frames
+    if (touched > context.save_size) std::memset(top - touched, stack_fill, touched - context.save_size);
+    stack->owner = &context;
+}
+#endif
+
+
 std::string_view get_state_string(TaskState state) {
     switch (state) {
     case TaskState::dead: return "dead";
@@ -23,7 +87,8 @@ void CoSched::Task::kill() {
     get_scheduler().delete_task(this);
 }
 
-bool Task::yield() {
+bool Task::prepare_yield(bool& result) {
+    result = false;
     // If it was terminating, it can finally be declared dead now
     if (state == TaskState::terminating) {
         state = TaskState::dead;
@@ -33,13 +98,22 @@ bool Task::yield() {
     if (state == TaskState::dead) {
         return false;
     }
-    if (this != current) return true;
+    result = true;
+    if (this != current || run_inline) return false;
+    // Don't bother switching if this task would be picked again anyways
+    if (!suspended && !scheduler->has_competition(priority)) {
+        scheduler->skipped_switches.store(scheduler->skipped_switches.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        scheduler->record_skipped_switch(CycleClock::now());
+        return false;
+    }
     // It's just sleeping
     state = TaskState::sleeping;
     // Let's wait until we're back up!
-    stopped_at = std::chrono::system_clock::now();
-    if (mco_yield(coroutine) != MCO_SUCCESS)
-        return false;
+    stopped_at = std::chrono::steady_clock::now();
+    return true;
+}
+
+bool Task::finish_yield() {
     // If task was terminating during sleep, it can finally be declared dead now
     if (state == TaskState::terminating) {
         state = TaskState::dead;
@@ -50,62 +124,566 @@ bool Task::yield() {
     return true;
 }
 
+void Task::wait_resumed() {
+    const auto prev_state = state;
+    state = TaskState::sleeping;
+    stopped_at = std::chrono::steady_clock::now();
+#ifdef COSCHED2_USE_NATIVE_CONTEXT
+    switch_context(&context.sp, scheduler_sp);
+#else
+    mco_yield(coroutine);
+#endif
+    // Keep termination that happened during sleep
+    state = state == TaskState::terminating && prev_state == TaskState::running ? TaskState::terminating : prev_state;
+}
+
+bool Task::yield() {
+    bool result;
+    if (!prepare_yield(result)) return result;
+#ifdef COSCHED2_USE_NATIVE_CONTEXT
+    switch_context(&context.sp, scheduler_sp);
+#else
+    if (mco_yield(coroutine) != MCO_SUCCESS)
+        return false;
+#endif
+    return finish_yield();
+}
+
+bool Task::yield_to(Task& target) {
+#ifdef COSCHED2_DIRECT_SWITCH
+    // Fall back to regular yield if target can't be switched to directly
+    if (state != TaskState::running || this != current || run_inline || &target == this
+            || target.scheduler != scheduler || !target.has_context() || target.frame || !target.is_runnable())
+        return yield();
+#ifdef COSCHED2_USE_NATIVE_CONTEXT
+    // Targets stack can't be copied in while we are running on it
+    if (context.shared_stack && context.shared_stack == target.context.shared_stack)
+        return yield();
+#endif
+    // It's just sleeping
+    state = TaskState::sleeping;
+    stopped_at = std::chrono::steady_clock::now();
+    scheduler->switches.store(scheduler->switches.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    const auto now = CycleClock::now();
+    target.slice_end = now + (target.time_slice ? target.time_slice : scheduler->default_time_slice);
+    scheduler->trace_stop(this, now);
+    scheduler->record_resume(&target, now);
+#ifdef COSCHED2_TASK_STATS
+    stop_run(now);
+    target.start_run(now);
+#endif
+    // Target is treated as if it was picked and we are queued again, so policy charges target from now on
+    scheduler->switch_task(*scheduler, *this, target);
+    current = &target;
+#ifdef COSCHED2_USE_NATIVE_CONTEXT
+    // All tasks return to the same scheduler context, so just switch
+    make_resident(target.context);
+    switch_context(&context.sp, target.context.sp);
+#else
+    // Hand our way back to the scheduler over to target and switch to it
+    auto from_context = reinterpret_cast<_mco_context*>(coroutine->context);
+    auto to_context = reinterpret_cast<_mco_context*>(target.coroutine->context);
+    to_context->back_ctx = from_context->back_ctx;
+    target.coroutine->prev_co = coroutine->prev_co;
+    coroutine->prev_co = nullptr;
+    coroutine->state = MCO_SUSPENDED;
+    target.coroutine->state = MCO_RUNNING;
+    mco_current_co = target.coroutine;
+    _mco_switch(&from_context->ctx, &to_context->ctx);
+#endif
+    return finish_yield();
+#else
+    return yield();
+#endif
+}
+
 
-void Scheduler::clean_task(Task *task) {
-    // If current task has no way to resume, it is considered a zombie so removed from list
-    if (task && task->state == TaskState::deleting) {
-        delete_task(task);
+void Task::terminate() {
+    state = TaskState::terminating;
+    // Wake it up from wait
+    if (wait_cancel) {
+        wait_cancel(wait_object, *this);
+        unpark();
+        wait_cancelled = true;
+    }
+    for (auto scope = owned_scope; scope; scope = scope->outer) {
+        scope->cancel();
     }
 }
 
-void Scheduler::delete_task(Task *task) {
-    mco_destroy(task->coroutine);
-    tasks.erase(std::find_if(tasks.begin(), tasks.end(), [task] (const auto& o) {return o.get() == task;}));
+void Task::set_suspended(bool value) {
+    if (suspended == value) return;
+    suspended = value;
+    if (!value) woken_at = CycleClock::now();
+    scheduler->suspended_tasks.store(scheduler->suspended_tasks.load(std::memory_order_relaxed) + (value ? 1 : -1), std::memory_order_relaxed);
+    // Scheduler needs to catch up on this change if it wasn't made by the task itself
+    if (this != current) scheduler->add_pending(this);
 }
 
-Task *Scheduler::get_next_task() {
-    // Get tasks with highest priority
-    std::vector<Task*> max_prio_tasks;
-    Priority max_prio = std::numeric_limits<Priority>::min();
-    for (auto& task : tasks) {
-        // Filter tasks can't currently be resumed
-        if (task->state == TaskState::running) continue;
-        // Filter tasks that are suspended
-        if (task->suspended) continue;
-        // Update max priority
-        if (task->priority > max_prio) {
-            max_prio = task->priority;
-            max_prio_tasks.clear();
-        }
-        // Add task if matching
-        if (task->priority == max_prio) {
-            max_prio_tasks.push_back(task.get());
+void Task::set_deadline(std::chrono::steady_clock::time_point value) {
+    deadline = value;
+    // Policy may have to reorder task
+    if (queued) {
+        requeue = true;
+        scheduler->add_pending(this);
+    }
+}
+
+
+FramePool::~FramePool() {
+    for (auto frame : free_frames) {
+        while (frame) {
+            auto next = frame->next;
+            std::free(reinterpret_cast<Header*>(frame) - 1);
+            frame = next;
         }
     }
+}
 
-    // Get least recently stopped task
-    Task *next_task = nullptr;
-    for (auto task : max_prio_tasks) {
-        if (!next_task || task->stopped_at < next_task->stopped_at) {
-            next_task = task;
+void *FramePool::allocate(size_t size) {
+    FramePool *pool = Task::current ? &Task::current->scheduler->frame_pool : nullptr;
+    const size_t size_class = (size + granularity - 1) / granularity;
+    // Frames too large to be worth caching aren't taken from pool
+    if (!pool || size_class >= pool->free_frames.size()) pool = nullptr;
+    Header *header;
+    if (pool && pool->free_frames[size_class]) {
+        auto frame = pool->free_frames[size_class];
+        pool->free_frames[size_class] = frame->next;
+        header = reinterpret_cast<Header*>(frame) - 1;
+    } else {
+        header = static_cast<Header*>(std::malloc(sizeof(Header) + (pool ? size_class * granularity : size)));
+        if (!header) throw std::bad_alloc();
+    }
+    header->pool = pool;
+    header->size_class = size_class;
+    return header + 1;
+}
+
+void FramePool::deallocate(void *frame) {
+    auto header = static_cast<Header*>(frame) - 1;
+    auto pool = header->pool;
+    if (!pool) {
+        std::free(header);
+        return;
+    }
+    auto free_frame = static_cast<FreeFrame*>(frame);
+    free_frame->next = pool->free_frames[header->size_class];
+    pool->free_frames[header->size_class] = free_frame;
+}
+
+
+std::pmr::memory_resource *Task::get_memory_resource() const {
+    if (arena) return arena;
+    return std::pmr::get_default_resource();
+}
+
+size_t Task::get_stack_peak() const {
+    if (!stack_watermark) return 0;
+#ifdef COSCHED2_USE_NATIVE_CONTEXT
+    if (auto stack = context.shared_stack) {
+        // Shared stack only holds our frames while we own it
+        if (stack->owner != &context) return context.stack_peak;
+        return std::max(context.stack_peak, measure_stack(stack->memory, stack->size));
+    }
+    return measure_stack(context.stack, context.stack_size);
+#else
+    return measure_stack(coroutine->stack_base, coroutine->stack_size);
+#endif
+}
+
+
+ArenaPool::~ArenaPool() {
+    while (free_blocks) {
+        auto next = free_blocks->next;
+        std::free(free_blocks);
+        free_blocks = next;
+    }
+}
+
+void *ArenaPool::allocate() {
+    if (free_blocks) {
+        auto block = free_blocks;
+        free_blocks = block->next;
+        return block;
+    }
+    auto block = std::malloc(block_size);
+    if (!block) throw std::bad_alloc();
+    ++block_count;
+    return block;
+}
+
+
+TaskArena *TaskArena::create(SchedulerBase& scheduler) {
+    auto block = static_cast<Block*>(scheduler.arena_pool.allocate());
+    return new (block + 1) TaskArena(scheduler, block);
+}
+
+void TaskArena::destroy() {
+    auto& scheduler = this->scheduler;
+    auto first = reinterpret_cast<Block*>(this) - 1;
+    auto last = last_block;
+    auto large = large_blocks;
+    // Only read by other threads, no need for compare and exchange
+    if (used > scheduler.arena_high_water.load(std::memory_order_relaxed))
+        scheduler.arena_high_water.store(used, std::memory_order_relaxed);
+    this->~TaskArena();
+    while (large) {
+        auto next = large->next;
+        std::free(large);
+        large = next;
+    }
+    scheduler.arena_pool.deallocate(first, last);
+}
+
+void *TaskArena::allocate_slow(size_t bytes, size_t alignment) {
+    const auto block_size = scheduler.arena_pool.get_block_size();
+    // Allocations that wouldn't fit into an empty block get their own memory
+    if (sizeof(Block) + bytes + alignment > block_size) {
+        const auto large_alignment = std::max(alignof(LargeBlock), alignment);
+        const auto header_size = std::max(sizeof(LargeBlock), alignment);
+        // Size MUST be a multiple of the alignment passed to aligned_alloc
+        auto large = static_cast<LargeBlock*>(std::aligned_alloc(large_alignment,
+                                                                 (header_size + bytes + large_alignment - 1) / large_alignment * large_alignment));
+        if (!large) throw std::bad_alloc();
+        large->next = large_blocks;
+        large_blocks = large;
+        used += bytes;
+        return reinterpret_cast<char*>(large) + header_size;
+    }
+    // Continue in a new block, rest of the current one is wasted
+    auto block = static_cast<Block*>(scheduler.arena_pool.allocate());
+    block->next = nullptr;
+    last_block->next = block;
+    last_block = block;
+    pos = reinterpret_cast<char*>(block + 1);
+    end = reinterpret_cast<char*>(block) + block_size;
+    return do_allocate(bytes, alignment);
+}
+
+
+SchedulerBase::~SchedulerBase() {
+    // Tasks that haven't finished are cleaned up like finished ones
+    for (auto& task : tasks) {
+        free_task(task.get());
+    }
+    // Last task run MUST NOT be cleaned up by the next scheduler run on this thread
+    if (Task::current && Task::current->scheduler == this) Task::current = nullptr;
+    for (auto& stack : shared_stacks) {
+        std::free(stack.memory);
+    }
+}
+
+
+Task *SchedulerBase::add_task(const std::string& name, std::function<void ()>&& start_fcn, const TaskOptions& options) {
+    Task *task = tasks.emplace_back(std::make_unique<Task>(this, name)).get();
+    task->id = next_task_id++;
+    task->index = tasks.size() - 1;
+    task->start_fcn = std::move(start_fcn);
+    task->priority = options.priority;
+    task->stack_size = options.stack_size;
+    task->deadline = options.deadline;
+    task->group = options.group;
+    task->set_time_slice(options.time_slice);
+    task->shared_stack = options.shared_stack;
+    task->run_inline = options.run_inline;
+    if (options.arena) task->arena = TaskArena::create(*this);
+    task->submitted_at = CycleClock::now();
+    trace(TraceEventType::spawn, task, task->submitted_at);
+    tasks_created.store(tasks_created.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    // Queue it like any task that has yielded
+    task->state = TaskState::sleeping;
+    task->stopped_at = std::chrono::steady_clock::now();
+    return task;
+}
+
+void SchedulerBase::free_task(Task *task) {
+    // Locals go first, they may refer to the stack or arena of the task
+    for (auto& slot : task->locals) {
+        if (slot.value) slot.destroy(slot.value);
+    }
+    task->locals.clear();
+    if (task->frame) {
+        task->frame_destroy(task->frame);
+        task->frame = nullptr;
+    } else if (task->has_context()) {
+#ifdef COSCHED2_USE_NATIVE_CONTEXT
+        if (auto stack = task->context.shared_stack) {
+            if (stack->owner == &task->context) stack->owner = nullptr;
+            std::free(task->context.save_buffer);
+        } else {
+            std::free(task->context.stack);
         }
+#else
+        mco_destroy(task->coroutine);
+#endif
     }
+    if (task->arena) task->arena->destroy();
+    task->arena = nullptr;
+}
 
-    // Return next task;
-    return next_task;
+void SchedulerBase::delete_task(Task *task) {
+    if (trace_buffer.is_enabled()) trace(TraceEventType::exit, task, CycleClock::now());
+    if (task->scope) task->scope->remove(task);
+    if (task->stack_watermark && !task->frame && task->has_context()) {
+        const size_t peak = task->get_stack_peak();
+        stack_usage[task->name].record(peak);
+        if (stack_peak_hook) stack_peak_hook(*task, peak);
+    }
+    free_task(task);
+    if (task->in_pending) pending.erase(std::find(pending.begin(), pending.end(), task));
+    if (task->suspended) suspended_tasks.store(suspended_tasks.load(std::memory_order_relaxed) - 1, std::memory_order_relaxed);
+    tasks_exited.store(tasks_exited.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    // Move last task into place of deleted one
+    const auto index = task->index;
+    if (index != tasks.size() - 1) {
+        tasks[index] = std::move(tasks.back());
+        tasks[index]->index = index;
+    }
+    tasks.pop_back();
 }
 
-void Scheduler::run_once() {
-    // Clean up old task
-    clean_task(Task::current);
+void SchedulerBase::walk_stack(const Task& task, std::vector<uintptr_t>& frames, size_t max_depth) {
+    // Find saved frame pointer and return address along with the part of the stack that is in use
+    uintptr_t pc = 0, fp = 0, low = 0, high = 0;
+    const char *copy = nullptr; // Stack is read from here instead if it has been copied out
+#ifdef COSCHED2_USE_NATIVE_CONTEXT
+    const auto& context = task.context;
+    if (!context.sp) return;
+    high = reinterpret_cast<uintptr_t>(context.stack) + context.stack_size;
+    if (context.shared_stack && context.shared_stack->owner != &context) {
+        high = reinterpret_cast<uintptr_t>(context.shared_stack->memory) + context.shared_stack->size;
+        copy = static_cast<const char*>(context.save_buffer);
+        low = high - context.save_size;
+    } else {
+        low = reinterpret_cast<uintptr_t>(context.sp);
+    }
+#elif defined(MCO_USE_ASM) && (defined(__x86_64__) || defined(__aarch64__))
+    if (!task.coroutine) return;
+    const auto& ctx = reinterpret_cast<_mco_context*>(task.coroutine->context)->ctx;
+    high = reinterpret_cast<uintptr_t>(task.coroutine->stack_base) + task.coroutine->stack_size;
+#   if defined(__x86_64__)
+    pc = reinterpret_cast<uintptr_t>(ctx.rip);
+    fp = reinterpret_cast<uintptr_t>(ctx.rbp);
+    low = reinterpret_cast<uintptr_t>(ctx.rsp);
+#   else
+    pc = reinterpret_cast<uintptr_t>(ctx.lr);
+    fp = reinterpret_cast<uintptr_t>(ctx.x[10]);
+    low = reinterpret_cast<uintptr_t>(ctx.sp);
+#   endif
+#else
+    // Saved context can't be inspected with this backend
+    return;
+#endif
+    const auto read = [&] (uintptr_t address, uintptr_t& value) {
+        if (address < low || address + sizeof(value) > high || address % sizeof(value)) return false;
+        if (copy) std::memcpy(&value, copy + (address - low), sizeof(value));
+        else std::memcpy(&value, reinterpret_cast<const void*>(address), sizeof(value));
+        return true;
+    };
+#ifdef COSCHED2_USE_NATIVE_CONTEXT
+    // Registers have been pushed by switch_context()
+#   if defined(__x86_64__)
+    if (!read(low + 7 * sizeof(uintptr_t), pc) || !read(low + 6 * sizeof(uintptr_t), fp)) return;
+#   else
+    if (!read(low + 11 * sizeof(uintptr_t), pc) || !read(low + 10 * sizeof(uintptr_t), fp)) return;
+#   endif
+#endif
+    frames.push_back(pc);
+    // Every frame starts with the previous frame pointer followed by the return address
+    for (size_t depth = 1; depth < max_depth; depth++) {
+        uintptr_t next_fp, return_address;
+        if (!read(fp, next_fp) || !read(fp + sizeof(uintptr_t), return_address) || !return_address) break;
+        // minicoro puts a dummy return address at the stack top
+        if (return_address == static_cast<uintptr_t>(0xdeaddeaddeaddead)) break;
+        frames.push_back(return_address);
+        // Frames MUST go towards the stack top, anything else means the chain is broken
+        if (next_fp <= fp) break;
+        fp = next_fp;
+    }
+}
 
-    // Get new task
-    Task::current = get_next_task();
+OffCpuProfile SchedulerBase::sample_off_cpu(size_t max_depth) const {
+    OffCpuProfile fres;
+    fres.samples.reserve(tasks.size());
+    const auto now = std::chrono::steady_clock::now();
+    for (const auto& task : tasks) {
+        if (task->state == TaskState::running || task->state == TaskState::deleting) continue;
+        auto& sample = fres.samples.emplace_back();
+        sample.task_id = task->id;
+        sample.task_name = task->name;
+        sample.kind = task->frame ? OffCpuProfile::Kind::stackless
+                    : task->has_context() ? OffCpuProfile::Kind::stackful : OffCpuProfile::Kind::not_started;
+        sample.suspended = task->suspended;
+        sample.parked_for = now - task->stopped_at;
+        sample.first_frame = fres.frames.size();
+        if (sample.kind == OffCpuProfile::Kind::stackful) walk_stack(*task, fres.frames, max_depth);
+        sample.frame_count = fres.frames.size() - sample.first_frame;
+    }
+    return fres;
+}
 
-    // Resume task if any
-    if (Task::current) mco_resume(Task::current->coroutine);
+size_t SchedulerBase::trim_stacks(std::chrono::nanoseconds min_parked, bool lazy) {
+    size_t fres = 0;
+#ifdef COSCHED2_HAS_MADVISE
+#   ifdef MADV_FREE
+    const int advice = lazy ? MADV_FREE : MADV_DONTNEED;
+#   else
+    const int advice = MADV_DONTNEED;
+    (void)lazy;
+#   endif
+    const uintptr_t page_size = sysconf(_SC_PAGESIZE);
+    const auto now = std::chrono::steady_clock::now();
+#   ifdef __linux__
+    std::vector<unsigned char> resident;
+#   endif
+    for (const auto& task : tasks) {
+        // Stacks are only touched again once the task has run, so each stop needs to be trimmed once only
+        if (!task->suspended || task->state != TaskState::sleeping || task->stack_watermark
+                || task->trimmed_stop == task->stopped_at || now - task->stopped_at < min_parked) continue;
+        // Everything below the saved stack pointer is unused
+        uintptr_t low, sp;
+#   ifdef COSCHED2_USE_NATIVE_CONTEXT
+        if (!task->context.sp || task->context.shared_stack) continue;
+        low = reinterpret_cast<uintptr_t>(task->context.stack);
+        sp = reinterpret_cast<uintptr_t>(task->context.sp);
+#   elif defined(MCO_USE_ASM) && (defined(__x86_64__) || defined(__aarch64__))
+        if (!task->coroutine) continue;
+        low = reinterpret_cast<uintptr_t>(task->coroutine->stack_base);
+        const auto& ctx = reinterpret_cast<_mco_context*>(task->coroutine->context)->ctx;
+#       if defined(__x86_64__)
+        sp = reinterpret_cast<uintptr_t>(ctx.rsp);
+#       else
+        sp = reinterpret_cast<uintptr_t>(ctx.sp);
+#       endif
+#   else
+        // Saved stack pointer can't be found with this backend
+        break;
+#   endif
+        task->trimmed_stop = task->stopped_at;
+        // Only whole pages can be given back
+        const uintptr_t begin = (low + page_size - 1) & ~(page_size - 1), end = sp & ~(page_size - 1);
+        if (end <= begin) continue;
+        size_t trimmed = end - begin;
+#   ifdef __linux__
+        // Only count pages that have actually been resident
+        resident.resize(trimmed / page_size);
+        if (mincore(reinterpret_cast<void*>(begin), trimmed, resident.data()) == 0) {
+            trimmed = std::count_if(resident.begin(), resident.end(), [] (unsigned char page) {return page & 1;}) * page_size;
+            if (!trimmed) continue;
+        }
+#   endif
+        if (madvise(reinterpret_cast<void*>(begin), end - begin, advice) != 0) continue;
+        fres += trimmed;
+    }
+    stack_bytes_trimmed.store(stack_bytes_trimmed.load(std::memory_order_relaxed) + fres, std::memory_order_relaxed);
+#else
+    (void)min_parked;
+    (void)lazy;
+#endif
+    return fres;
 }
 
+void SchedulerBase::launch_task(Task *task) {
+    // Task may have been terminated before it got to start
+    if (task->state == TaskState::terminating) {
+        task->state = TaskState::deleting;
+        return;
+    }
+    task->state = TaskState::running;
+    // Stackless tasks get their frame now and inline tasks don't need a context at all
+    if (task->stackless) task->start_fcn();
+    if (task->frame || task->run_inline) {
+        resume_task(task);
+        return;
+    }
+#ifdef COSCHED2_USE_NATIVE_CONTEXT
+    // Create stack and context
+    if (task->shared_stack && shared_stack_count) {
+        // Take turns on shared stacks
+        if (shared_stacks.empty()) {
+            shared_stacks.resize(shared_stack_count);
+            for (auto& stack : shared_stacks) {
+                stack.size = shared_stack_size & ~size_t(15);
+                stack.memory = std::aligned_alloc(16, stack.size);
+                if (stack_watermark) {
+                    std::memset(stack.memory, stack_fill, stack.size);
+                    stack.watermarked = true;
+                }
+            }
+        }
+        auto& stack = shared_stacks[next_shared_stack++ % shared_stacks.size()];
+        task->context.shared_stack = &stack;
+        task->stack_watermark = stack.watermarked;
+        make_resident(task->context);
+        task->context.stack = stack.memory;
+        task->context.stack_size = stack.size;
+    } else {
+        task->context.stack_size = task->stack_size ? (task->stack_size + 15) & ~size_t(15) : MCO_DEFAULT_STACK_SIZE;
+        task->context.stack = std::aligned_alloc(16, task->context.stack_size);
+        if (stack_watermark) {
+            std::memset(task->context.stack, stack_fill, task->context.stack_size);
+            task->stack_watermark = true;
+        }
+    }
+    task->context.sp = make_context(task->context.stack, task->context.stack_size, [] (void *task_ptr) {
+        auto task = static_cast<Task*>(task_ptr);
+        task->start_fcn();
+        task->state = TaskState::deleting;
+        // Current task may have changed through direct switches
+        switch_context(&task->context.sp, scheduler_sp);
+    }, task);
+#else
+    // Create coroutine
+    mco_desc desc = mco_desc_init([] (mco_coro *coro) {
+        Task::get_current().start_fcn();
+        Task::get_current().state = TaskState::deleting;
+    }, task->stack_size);
+    if (stack_watermark) {
+        // Fill whole allocation, minicoro only initializes its bookkeeping and the top of the stack
+        desc.alloc_cb = [] (size_t size, void *allocator_data) {
+            void *fres = mco_alloc(size, allocator_data);
+            if (fres) std::memset(fres, stack_fill, size);
+            return fres;
+        };
+        task->stack_watermark = true;
+    }
+    mco_create(&task->coroutine, &desc);
+#endif
+    // Resume coroutine immediately
+    resume_task(task);
+}
+
+void SchedulerBase::resume_task(Task *task) {
+    resumed = task;
+    switches.store(switches.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    const auto now = CycleClock::now();
+    task->slice_end = now + (task->time_slice ? task->time_slice : default_time_slice);
+    record_resume(task, now);
+#ifdef COSCHED2_TASK_STATS
+    task->start_run(now);
+#endif
+    if (task->frame) {
+        // Stackless tasks run on our stack until they suspend
+        if (task->frame_resume(task->frame)) task->state = TaskState::deleting;
+        return;
+    }
+    if (task->run_inline) {
+        // Inline tasks run on our stack until they are done
+        task->start_fcn();
+        task->state = TaskState::deleting;
+        return;
+    }
+#ifdef COSCHED2_USE_NATIVE_CONTEXT
+    make_resident(task->context);
+    switch_context(&scheduler_sp, task->context.sp);
+#else
+    mco_resume(task->coroutine);
+#endif
+}
+
+
+template class BasicScheduler<PriorityPolicy>;
+
 
 thread_local Task *Task::current;
 }
@@ -0,0 +1,66 @@
+#include "check.hpp"
+
+#include <atomic>
+#include <thread>
+#include <cosched2/scheduled_thread.hpp>
+
+using namespace CoSched;
+
+
+
+// Tasks submitted while many tasks are ready are admitted right away if their priority is high enough
+static void high_priority() {
+    ScheduledThread thread;
+    std::atomic<unsigned> yields = 0;
+    std::atomic<bool> realtime_ran = false;
+    unsigned finished = 0, finished_at_realtime = 0;
+    for (unsigned index = 0; index != 100; index++) {
+        thread.create_task("busy", [&] () {
+            for (unsigned round = 0; round != 20000 && !realtime_ran.load(std::memory_order_relaxed); round++) {
+                yields.fetch_add(1, std::memory_order_relaxed);
+                Task::get_current().yield();
+            }
+            finished++;
+        });
+    }
+    thread.start();
+    // Wait for busy tasks to have taken over
+    while (yields.load(std::memory_order_relaxed) < 1000) std::this_thread::yield();
+    TaskOptions options;
+    options.priority = PRIO_REALTIME;
+    thread.create_task("realtime", [&] () {
+        finished_at_realtime = finished;
+        realtime_ran.store(true, std::memory_order_relaxed);
+    }, options);
+    thread.wait();
+    CHECK(realtime_ran.load(std::memory_order_relaxed));
+    CHECK(finished_at_realtime == 0);
+}
+
+// Tasks of lower priority are still admitted while many tasks are ready, just one at a time
+static void lower_priority() {
+    ScheduledThread thread;
+    thread.set_admission_limit(16);
+    bool all_admitted = false;
+    for (unsigned index = 0; index != 20; index++) {
+        thread.create_task("busy", [&] () {
+            auto& sched = Task::get_current().get_scheduler();
+            for (unsigned round = 0; round != 20000 && !all_admitted; round++) {
+                if (sched.get_tasks().size() == 40) all_admitted = true;
+                else Task::get_current().yield();
+            }
+        });
+    }
+    for (unsigned index = 0; index != 20; index++) {
+        thread.create_task("idle", [] () {}, TaskOptions{.priority = PRIO_LOW});
+    }
+    thread.start();
+    thread.wait();
+    CHECK(all_admitted);
+}
+
+
+int main() {
+    high_priority();
+    lower_priority();
+}
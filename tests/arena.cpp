@@ -0,0 +1,62 @@
+#include "check.hpp"
+
+#include <cstdint>
+#include <cstring>
+#include <cosched2/task_arena.hpp>
+
+using namespace CoSched;
+
+
+
+static bool is_aligned(void *ptr, size_t alignment) {
+    return reinterpret_cast<uintptr_t>(ptr) % alignment == 0;
+}
+
+
+// Allocations are aligned as requested, whether they fit into a block or not
+static void alignment() {
+    Scheduler sched;
+    sched.get_arena_pool().set_block_size(4096);
+    TaskOptions options;
+    options.arena = true;
+    sched.create_task("task", [] () {
+        auto& arena = *Task::get_current().get_arena();
+        // Sizes that aren't a multiple of the alignment, small and large
+        for (const size_t bytes : {1, 24, 1000, 4095, 4097, 10001}) {
+            for (const size_t alignment : {1, 2, 8, 16, 64, 256}) {
+                auto ptr = arena.allocate(bytes, alignment);
+                CHECK(is_aligned(ptr, alignment));
+                std::memset(ptr, 0xAA, bytes);
+            }
+        }
+        CHECK(arena.get_used() > 6 * 10001);
+    }, options);
+    sched.run();
+}
+
+// Blocks are given back to the pool once the task is gone and reused by the next task
+static void block_reuse() {
+    Scheduler sched;
+    sched.get_arena_pool().set_block_size(4096);
+    TaskOptions options;
+    options.arena = true;
+    size_t blocks = 0;
+    for (unsigned round = 0; round != 2; round++) {
+        sched.create_task("task", [] () {
+            auto& arena = *Task::get_current().get_arena();
+            for (unsigned index = 0; index != 10; index++) {
+                std::memset(arena.allocate(1000), 0, 1000);
+            }
+        }, options);
+        sched.run();
+        if (round == 0) blocks = sched.get_arena_pool().get_block_count();
+    }
+    CHECK(blocks > 1);
+    CHECK(sched.get_arena_pool().get_block_count() == blocks);
+}
+
+
+int main() {
+    alignment();
+    block_reuse();
+}
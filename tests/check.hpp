@@ -0,0 +1,23 @@
+#ifndef CHECK_HPP
+#define CHECK_HPP
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+
+// Aborts the test if condition doesn't hold, works from within tasks as well
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            std::fprintf(stderr, "%s:%d: Check failed: %s\n", __FILE__, __LINE__, #condition); \
+            std::abort(); \
+        } \
+    } while (false)
+
+
+// Keeps the thread busy without yielding, like a task doing actual work
+inline void busy_wait(std::chrono::microseconds duration) {
+    const auto until = std::chrono::steady_clock::now() + duration;
+    while (std::chrono::steady_clock::now() < until);
+}
+#endif // CHECK_HPP
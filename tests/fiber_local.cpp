@@ -0,0 +1,62 @@
+#include "check.hpp"
+
+#include <cosched2/fiber_local.hpp>
+
+using namespace CoSched;
+
+
+
+// Counts instances alive, to see when fiber locals are destroyed
+struct Counted {
+    static inline unsigned alive = 0;
+    unsigned value = 0;
+
+    Counted() {
+        alive++;
+    }
+    ~Counted() {
+        alive--;
+    }
+};
+
+static FiberLocal<Counted> local;
+
+
+// Every task has its own value, destroyed along with the task
+static void per_task() {
+    Scheduler sched;
+    for (unsigned index = 0; index != 2; index++) {
+        sched.create_task("task", [index] () {
+            local->value = index + 1;
+            Task::get_current().yield();
+            CHECK(local->value == index + 1);
+        });
+    }
+    sched.run();
+    CHECK(Counted::alive == 0);
+}
+
+// Values of tasks that haven't finished are destroyed along with the scheduler
+static void unfinished_task() {
+    bool started = false;
+    {
+        Scheduler sched;
+        sched.create_task("task", [&] () {
+            local->value = 1;
+            started = true;
+            // Never resumed
+            Task::get_current().set_suspended(true);
+            Task::get_current().yield();
+        });
+        sched.run_once();
+        CHECK(started);
+        CHECK(Counted::alive == 1);
+    }
+    CHECK(Counted::alive == 0);
+}
+
+
+int main() {
+    per_task();
+    unfinished_task();
+}
@@ -0,0 +1,78 @@
+#include "check.hpp"
+
+#include <cstdint>
+#include <cosched2/histogram.hpp>
+
+using namespace CoSched;
+
+
+
+// Buckets cover all values without gaps, each within 1/16 of the values in it
+static void bucketing() {
+    using B = HistogramBuckets;
+    for (uint64_t value = 0; value != B::sub_buckets; value++) {
+        CHECK(B::get_index(value) == value);
+        CHECK(B::get_upper_bound(value) == value);
+    }
+    for (unsigned index = 0; index + 1 != B::count; index++) {
+        const uint64_t upper = B::get_upper_bound(index);
+        CHECK(B::get_index(upper) == index);
+        CHECK(B::get_index(upper + 1) == index + 1);
+    }
+    CHECK(B::get_index(UINT64_MAX) == B::count - 1);
+    CHECK(B::get_upper_bound(B::count - 1) == UINT64_MAX);
+    // Sweep through all magnitudes
+    unsigned last_index = 0;
+    for (uint64_t value = 1; value < UINT64_MAX / 3; value = value * 3 / 2 + 1) {
+        const unsigned index = B::get_index(value);
+        CHECK(index >= last_index);
+        last_index = index;
+        const uint64_t upper = B::get_upper_bound(index);
+        CHECK(upper >= value);
+        CHECK(upper - value <= value / B::sub_buckets);
+    }
+}
+
+// Percentiles are taken from the upper bounds of the buckets they fall into
+static void percentiles() {
+    const auto ns = [] (uint64_t ticks) {
+        return std::chrono::nanoseconds(CycleClock::to_ns(HistogramBuckets::get_upper_bound(HistogramBuckets::get_index(ticks))));
+    };
+    Histogram histogram;
+    CHECK(histogram.get_snapshot().get_percentile(0.5).count() == 0);
+    CHECK(histogram.get_snapshot().get_max().count() == 0);
+    CHECK(histogram.get_snapshot().get_mean().count() == 0);
+    for (unsigned index = 0; index != 90; index++) histogram.record(10);
+    for (unsigned index = 0; index != 10; index++) histogram.record(100000);
+    const auto snapshot = histogram.get_snapshot();
+    CHECK(snapshot.get_count() == 100);
+    CHECK(snapshot.get_sum().count() == static_cast<int64_t>(CycleClock::to_ns(90 * 10 + 10 * 100000)));
+    CHECK(snapshot.get_mean().count() == static_cast<int64_t>(CycleClock::to_ns((90 * 10 + 10 * 100000) / 100)));
+    CHECK(snapshot.get_percentile(0.0) == ns(10));
+    CHECK(snapshot.get_percentile(0.5) == ns(10));
+    CHECK(snapshot.get_percentile(0.9) == ns(10));
+    CHECK(snapshot.get_percentile(0.91) == ns(100000));
+    CHECK(snapshot.get_percentile(1.0) == ns(100000));
+    CHECK(snapshot.get_max() == ns(100000));
+}
+
+// Merged snapshots hold the values of both
+static void merge() {
+    Histogram a, b;
+    a.record(5);
+    b.record(1000);
+    b.record(1000);
+    auto snapshot = a.get_snapshot();
+    snapshot += b.get_snapshot();
+    CHECK(snapshot.get_count() == 3);
+    CHECK(snapshot.get_sum().count() == static_cast<int64_t>(CycleClock::to_ns(2005)));
+    CHECK(snapshot.get_percentile(0.3).count() == static_cast<int64_t>(CycleClock::to_ns(5)));
+    CHECK(snapshot.get_max() == b.get_snapshot().get_max());
+}
+
+
+int main() {
+    bucketing();
+    percentiles();
+    merge();
+}
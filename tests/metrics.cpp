@@ -0,0 +1,128 @@
+#include "check.hpp"
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <cosched2/metrics.hpp>
+#include <cosched2/scheduler_mutex.hpp>
+
+using namespace CoSched;
+
+
+
+static bool contains(const std::string& text, const std::string& line) {
+    return text.find(line + '\n') != std::string::npos;
+}
+
+
+// Snapshots count tasks by state and ready tasks by priority
+static void snapshot() {
+    Scheduler sched;
+    Mutex mutex;
+    bool checked = false;
+    TaskOptions low;
+    low.priority = PRIO_LOW;
+    sched.create_task("holder", [&] () {
+        auto guard = mutex.lock();
+        Task::get_current().yield();
+        const auto metrics = sched.get_metrics();
+        CHECK(metrics.tasks == 3);
+        CHECK(metrics.suspended_tasks == 1);
+        CHECK((metrics.ready_tasks == std::map<Priority, size_t>{{PRIO_LOW, 1}}));
+        CHECK(metrics.get_ready_tasks() == 1);
+        CHECK(metrics.injection_queue_size == 0);
+        checked = true;
+    });
+    sched.create_task("low", [] () {}, low);
+    sched.create_task("waiter", [&] () {
+        auto guard = mutex.lock();
+    });
+    sched.run();
+    CHECK(checked);
+    const auto metrics = sched.get_metrics();
+    CHECK(metrics.tasks_created == 3 && metrics.tasks_exited == 3 && metrics.tasks == 0);
+    CHECK(metrics.get_ready_tasks() == 0);
+    CHECK(metrics.switches >= 4);
+}
+
+// Snapshots add up, rates are taken over the time between two snapshots
+static void combine() {
+    SchedulerMetrics a, b;
+    b.taken_at = a.taken_at + std::chrono::seconds(2);
+    a.switches = 100;
+    b.switches = 300;
+    CHECK(b.get_rate(&SchedulerMetrics::switches, a) == 100.0);
+    CHECK(a.get_rate(&SchedulerMetrics::switches, a) == 0.0);
+    a.ready_tasks = {{PRIO_NORMAL, 2}, {PRIO_LOW, 1}};
+    b.ready_tasks = {{PRIO_NORMAL, 3}};
+    a.arena_high_water = 4096;
+    b.arena_high_water = 1024;
+    a += b;
+    CHECK(a.taken_at == b.taken_at);
+    CHECK(a.switches == 400);
+    CHECK((a.ready_tasks == std::map<Priority, size_t>{{PRIO_NORMAL, 5}, {PRIO_LOW, 1}}));
+    CHECK(a.arena_high_water == 4096);
+}
+
+// Every scheduler gets a sample per family, labeled with its escaped name
+static void render() {
+    Scheduler a, b;
+    MetricsExporter exporter("test_");
+    exporter.add("a", a);
+    exporter.add("b \"quoted\"", b);
+    TaskOptions low;
+    low.priority = PRIO_LOW;
+    std::string rendered;
+    a.create_task("renderer", [&] () {
+        // Let low priority task be queued
+        Task::get_current().yield();
+        rendered = exporter.render();
+    });
+    a.create_task("low", [] () {}, low);
+    a.run();
+    CHECK(contains(rendered, "# HELP test_tasks Tasks known to the scheduler."));
+    CHECK(contains(rendered, "# TYPE test_tasks gauge"));
+    CHECK(contains(rendered, "test_tasks{scheduler=\"a\"} 2"));
+    CHECK(contains(rendered, "test_tasks{scheduler=\"b \\\"quoted\\\"\"} 0"));
+    CHECK(contains(rendered, "# TYPE test_ready_tasks gauge"));
+    CHECK(contains(rendered, "test_ready_tasks{scheduler=\"a\",priority=\"" + std::to_string(PRIO_LOW) + "\"} 1"));
+    CHECK(rendered.find("test_ready_tasks{scheduler=\"b") == std::string::npos);
+    CHECK(contains(rendered, "# TYPE test_switches_total counter"));
+    CHECK(contains(rendered, "test_tasks_created_total{scheduler=\"a\"} 2"));
+    CHECK(contains(rendered, "test_idle_seconds_total{scheduler=\"b \\\"quoted\\\"\"} 0.000000000"));
+    CHECK(contains(rendered, "# TYPE test_launch_latency_seconds summary"));
+    CHECK(rendered.find("test_launch_latency_seconds{scheduler=\"a\",quantile=\"0.99\"} ") != std::string::npos);
+    CHECK(contains(rendered, "test_launch_latency_seconds_count{scheduler=\"a\"} 1"));
+    CHECK(contains(rendered, "test_wait_time_seconds_count{scheduler=\"b \\\"quoted\\\"\"} 0"));
+    // Families are listed once each
+    size_t types = 0;
+    for (size_t pos = 0; (pos = rendered.find("# TYPE ", pos)) != std::string::npos; pos++) types++;
+    CHECK(types == 16);
+}
+
+// Written file holds exactly what is rendered
+static void write() {
+    Scheduler sched;
+    sched.create_task("task", [] () {});
+    sched.run();
+    MetricsExporter exporter;
+    exporter.add("sched", sched);
+    const std::string path = "cosched2_test_metrics.prom";
+    CHECK(exporter.write(path));
+    std::ifstream in(path, std::ios::binary);
+    std::stringstream contents;
+    contents << in.rdbuf();
+    CHECK(contents.str() == exporter.render());
+    CHECK(!std::ifstream(path + ".tmp"));
+    std::remove(path.c_str());
+    CHECK(!exporter.write("cosched2_test_missing_directory/metrics.prom"));
+}
+
+
+int main() {
+    snapshot();
+    combine();
+    render();
+    write();
+}
@@ -0,0 +1,102 @@
+#include "check.hpp"
+
+#include <string>
+#include <vector>
+#include <cosched2/scheduled_thread.hpp>
+#include <cosched2/scheduler_mutex.hpp>
+#include <cosched2/stackless.hpp>
+
+using namespace CoSched;
+
+
+
+// Lock is passed on in the order tasks have started waiting for it
+static void handoff_order() {
+    Scheduler sched;
+    Mutex mutex;
+    std::vector<std::string> order;
+    for (const char *name : {"A", "B", "C"}) {
+        sched.create_task(name, [&, name] () {
+            auto guard = mutex.lock();
+            order.push_back(name);
+            Task::get_current().yield();
+        });
+    }
+    sched.run();
+    CHECK((order == std::vector<std::string>{"A", "B", "C"}));
+}
+
+// Terminated tasks are woken up from their wait without the lock
+static void cancelled_wait() {
+    Scheduler sched;
+    Mutex mutex;
+    Task *waiter = nullptr;
+    bool cancelled = false;
+    sched.create_task("holder", [&] () {
+        auto guard = mutex.lock();
+        Task::get_current().yield();
+        waiter->terminate();
+        Task::get_current().yield();
+    });
+    waiter = &sched.create_task("waiter", [&] () {
+        auto guard = mutex.lock();
+        cancelled = guard.is_cancelled();
+    });
+    sched.run();
+    CHECK(cancelled);
+}
+
+// Inline tasks MUST NOT be queued on a held lock, they'd be gone by the time it is passed on
+static void inline_lock() {
+    Scheduler sched;
+    Mutex mutex;
+    TaskOptions options;
+    options.run_inline = true;
+    bool failed = false, relocked = false;
+    sched.create_task("holder", [&] () {
+        {
+            auto guard = mutex.lock();
+            Task::get_current().yield();
+        }
+        Task::get_current().get_scheduler().spawn("after", [&] () {
+            auto guard = mutex.lock();
+            relocked = !guard.is_failed() && !guard.is_cancelled();
+        }, options);
+    });
+    sched.create_task("inline", [&] () {
+        auto guard = mutex.lock();
+        failed = guard.is_failed();
+    }, options);
+    sched.run();
+    CHECK(failed);
+    CHECK(relocked);
+}
+
+// Same for stackless inline tasks
+static void inline_lock_async() {
+    Mutex mutex;
+    bool failed = false, tried = false;
+    ScheduledThread thread;
+    thread.create_task("holder", [&] () {
+        auto guard = mutex.lock();
+        while (!tried) Task::get_current().yield();
+    });
+    TaskOptions options;
+    options.run_inline = true;
+    thread.create_stackless_task("inline", [&] () -> Stackless {
+        auto guard = co_await mutex.lock_async();
+        failed = guard.is_failed();
+        tried = true;
+    }, options);
+    thread.start();
+    thread.wait();
+    CHECK(failed);
+}
+
+
+int main() {
+    handoff_order();
+    cancelled_wait();
+    inline_lock();
+    inline_lock_async();
+}
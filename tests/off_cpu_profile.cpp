@@ -0,0 +1,129 @@
+#include "check.hpp"
+
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <cosched2/off_cpu_profile.hpp>
+#include <cosched2/scheduler.hpp>
+#include <cosched2/scheduler_mutex.hpp>
+
+using namespace CoSched;
+
+
+
+// Saved contexts can only be inspected with assembly context switches, which sanitizers disable
+#if (defined(__x86_64__) || defined(__aarch64__)) && !defined(__SANITIZE_ADDRESS__) && !defined(__SANITIZE_THREAD__)
+static constexpr bool stacks_walkable = true;
+#else
+static constexpr bool stacks_walkable = false;
+#endif
+// Optimized builds of the library may omit frame pointers, cutting stacks short
+#ifndef __OPTIMIZE__
+static constexpr bool stacks_complete = stacks_walkable;
+#else
+static constexpr bool stacks_complete = false;
+#endif
+
+
+// Exported so its name can be found in the stack of the task parked in it
+[[gnu::noinline]] void off_cpu_parked_in(Mutex& mutex) {
+    auto guard = mutex.lock();
+}
+
+
+static bool contains(const std::string& text, const std::string& part) {
+    return text.find(part) != std::string::npos;
+}
+
+static OffCpuProfile sample_parked_tasks() {
+    Scheduler sched;
+    Mutex mutex;
+    OffCpuProfile fres;
+    bool ready_started = false;
+    TaskOptions low;
+    low.priority = PRIO_LOW;
+    sched.create_task("sampler", [&] () {
+        auto guard = mutex.lock();
+        while (!ready_started) Task::get_current().yield();
+        busy_wait(std::chrono::microseconds(1000));
+        fres = sched.sample_off_cpu();
+    });
+    sched.create_task("parked", [&] () {
+        off_cpu_parked_in(mutex);
+    });
+    sched.create_task("ready", [&] () {
+        ready_started = true;
+        Task::get_current().yield();
+    });
+    sched.create_task("late", [] () {}, low);
+    sched.run();
+    return fres;
+}
+
+
+// Every task that isn't running is sampled in its state, stacks of started tasks are walked
+static void samples() {
+    const auto profile = sample_parked_tasks();
+    CHECK(profile.samples.size() == 3);
+    for (const auto& sample : profile.samples) {
+        CHECK(sample.first_frame + sample.frame_count <= profile.frames.size());
+        if (sample.task_name == "parked") {
+            CHECK(sample.kind == OffCpuProfile::Kind::stackful);
+            CHECK(sample.suspended);
+            CHECK(sample.parked_for >= std::chrono::microseconds(1000));
+            CHECK(!stacks_walkable || sample.frame_count);
+        } else if (sample.task_name == "ready") {
+            CHECK(sample.kind == OffCpuProfile::Kind::stackful);
+            CHECK(!sample.suspended);
+            CHECK(!stacks_walkable || sample.frame_count);
+        } else {
+            CHECK(sample.task_name == "late");
+            CHECK(sample.kind == OffCpuProfile::Kind::not_started);
+            CHECK(!sample.suspended);
+            CHECK(sample.frame_count == 0);
+        }
+    }
+}
+
+// Folded stacks start with the state of the task, optionally followed by its name, and are symbolized
+static void folded() {
+    const auto profile = sample_parked_tasks();
+    const auto by_name = profile.to_folded(true);
+    CHECK(contains(by_name, "[suspended];parked"));
+    CHECK(contains(by_name, "[ready];ready"));
+    CHECK(contains(by_name, "\n[ready];late;[not started] ") || by_name.rfind("[ready];late;[not started] ", 0) == 0);
+    if (stacks_complete) CHECK(contains(by_name, ";off_cpu_parked_in(CoSched::Mutex&);"));
+    const auto anonymous = profile.to_folded();
+    CHECK(!contains(anonymous, "parked;") && !contains(anonymous, "late;"));
+    CHECK(contains(anonymous, "[ready];[not started] "));
+    // Every stack is weighted by the microseconds it has been parked for
+    std::istringstream lines(by_name);
+    unsigned count = 0;
+    for (std::string line; std::getline(lines, line); count++) {
+        const auto weight = std::stoull(line.substr(line.rfind(' ') + 1));
+        CHECK(weight >= 1);
+        if (line.rfind("[suspended];parked", 0) == 0) CHECK(weight >= 1000);
+    }
+    CHECK(count == 3);
+    const std::string path = "cosched2_test_off_cpu_profile.folded";
+    CHECK(profile.write_folded(path, true));
+    std::ifstream in(path, std::ios::binary);
+    std::stringstream contents;
+    contents << in.rdbuf();
+    CHECK(contents.str() == by_name);
+    std::remove(path.c_str());
+}
+
+// Addresses are symbolized to demangled names, or left as they are if unknown
+static void symbols() {
+    const auto address = reinterpret_cast<uintptr_t>(&off_cpu_parked_in);
+    CHECK(symbolize_address(address + 1) == "off_cpu_parked_in(CoSched::Mutex&)");
+    CHECK(symbolize_address(0) == "0x0");
+}
+
+
+int main() {
+    samples();
+    folded();
+    symbols();
+}
@@ -0,0 +1,186 @@
+#include "check.hpp"
+
+#include <string>
+#include <vector>
+#include <cosched2/scheduler_policy.hpp>
+
+using namespace CoSched;
+
+
+
+// Busy tasks that yield after every slice of work, counting the slices they got
+struct Workers {
+    std::vector<unsigned> slices;
+    unsigned total = 0, limit;
+
+    explicit Workers(unsigned limit) : limit(limit) {}
+
+    template<class Policy>
+    void create(BasicScheduler<Policy>& sched, const TaskOptions& options = {}) {
+        const size_t index = slices.size();
+        slices.push_back(0);
+        sched.create_task("worker", [this, index] () {
+            while (total < limit) {
+                busy_wait(std::chrono::microseconds(200));
+                slices[index]++;
+                total++;
+                Task::get_current().yield();
+            }
+        }, options);
+    }
+};
+
+
+// Higher priority tasks get a CPU share proportional to their weight
+static void fair_weights() {
+    BasicScheduler<FairPolicy> sched;
+    Workers workers(300);
+    TaskOptions options;
+    workers.create(sched, options);
+    options.priority = PRIO_HIGH;
+    workers.create(sched, options);
+    sched.run();
+    // PRIO_HIGH has twice the weight of PRIO_NORMAL
+    CHECK(workers.slices[1] * 10 > workers.slices[0] * 14);
+    CHECK(workers.slices[1] * 10 < workers.slices[0] * 28);
+}
+
+// Tasks created while another one is running MUST NOT keep it from being charged
+static void fair_create_between_rounds() {
+    BasicScheduler<FairPolicy> sched;
+    Workers workers(300);
+    workers.create(sched);
+    workers.create(sched);
+    // Like tasks admitted by ScheduledThread, one after every slice of work
+    for (unsigned seen = 0; workers.total < workers.limit;) {
+        sched.run_once();
+        if (workers.total == seen) continue;
+        seen = workers.total;
+        sched.create_task("child", [] () {});
+    }
+    sched.run();
+    CHECK(workers.slices[0] > workers.limit / 3);
+    CHECK(workers.slices[1] > workers.limit / 3);
+}
+
+// New tasks are charged a time slice up front, so spawned ones can't jump ahead of tasks that have been running
+static void fair_start_debit() {
+    BasicScheduler<FairPolicy> sched;
+    const auto& policy = sched.get_policy();
+    auto& normal = sched.create_task("normal", [] () {});
+    CHECK(normal.get_vruntime() == policy.get_min_vruntime() + CycleClock::from_ns(2000000));
+    TaskOptions options;
+    options.priority = PRIO_HIGH;
+    options.time_slice = std::chrono::milliseconds(1);
+    auto& high = sched.create_task("high", [] () {}, options);
+    CHECK(high.get_vruntime() == policy.get_min_vruntime() + CycleClock::from_ns(1000000) * FairPolicy::get_weight(PRIO_NORMAL) / FairPolicy::get_weight(PRIO_HIGH));
+    sched.run();
+    // Child has to wait until peer has caught up with its debit
+    unsigned peer_slices = 0, peer_slices_before_child = 0;
+    bool child_ran = false;
+    sched.create_task("spawner", [&] () {
+        auto& task = Task::get_current();
+        task.get_scheduler().spawn("child", [&] () {
+            peer_slices_before_child = peer_slices;
+            child_ran = true;
+        });
+        while (!child_ran) {
+            busy_wait(std::chrono::microseconds(200));
+            task.yield();
+        }
+    });
+    sched.create_task("peer", [&] () {
+        while (!child_ran) {
+            busy_wait(std::chrono::microseconds(200));
+            peer_slices++;
+            Task::get_current().yield();
+        }
+    });
+    sched.run();
+    CHECK(peer_slices_before_child >= 3);
+}
+
+// Groups get a CPU share proportional to their shares, regardless of how many tasks they have
+static void group_shares() {
+    TaskGroup small("small", 1024), large("large", 2048);
+    {
+        BasicScheduler<GroupPolicy> sched;
+        Workers workers(300);
+        TaskOptions options;
+        options.group = &small;
+        workers.create(sched, options);
+        workers.create(sched, options);
+        options.group = &large;
+        workers.create(sched, options);
+        CHECK(small.get_task_count() == 2);
+        CHECK(sched.get_policy().get_root_group().get_task_count() == 3);
+        sched.run();
+    }
+    CHECK(small.get_task_count() == 0);
+    CHECK(large.get_task_count() == 0);
+    CHECK(large.get_runtime_ns() * 10 > small.get_runtime_ns() * 14);
+    CHECK(large.get_runtime_ns() * 10 < small.get_runtime_ns() * 28);
+}
+
+// Groups outlive schedulers, those destroyed with tasks left MUST NOT leave them behind in their groups
+static void group_unfinished_tasks() {
+    TaskGroup group("group");
+    TaskOptions options;
+    options.group = &group;
+    {
+        BasicScheduler<GroupPolicy> sched;
+        sched.create_task("spawner", [&] () {
+            Task::get_current().get_scheduler().spawn("child", [] () {}, options);
+            while (true) Task::get_current().yield();
+        }, options);
+        for (unsigned index = 0; index != 2; index++) {
+            sched.create_task("worker", [] () {
+                while (true) Task::get_current().yield();
+            }, options);
+        }
+        sched.run_once();
+        CHECK(group.get_task_count() == 3);
+    }
+    CHECK(group.get_task_count() == 0);
+    // Tasks left queued in the group would keep it from being queued by the next scheduler
+    BasicScheduler<GroupPolicy> sched;
+    bool ran = false;
+    sched.create_task("task", [&] () {
+        ran = true;
+    }, options);
+    sched.run();
+    CHECK(ran);
+}
+
+// Tasks with a deadline run in deadline order ahead of others, missed ones are demoted
+static void deadline_order() {
+    BasicScheduler<DeadlinePolicy<>> sched;
+    std::vector<std::string> order;
+    const auto now = std::chrono::steady_clock::now();
+    const std::pair<const char*, std::chrono::steady_clock::time_point> tasks[] = {
+        {"none", std::chrono::steady_clock::time_point::max()},
+        {"late", now + std::chrono::seconds(20)},
+        {"early", now + std::chrono::seconds(10)},
+        {"missed", now - std::chrono::seconds(1)}
+    };
+    for (const auto& [name, deadline] : tasks) {
+        TaskOptions options;
+        options.deadline = deadline;
+        sched.create_task(name, [&order] () {
+            order.push_back(Task::get_current().get_name());
+        }, options);
+    }
+    sched.run();
+    CHECK((order == std::vector<std::string>{"early", "late", "none", "missed"}));
+    CHECK(sched.get_policy().get_deadline_misses() == 1);
+}
+
+
+int main() {
+    fair_weights();
+    fair_create_between_rounds();
+    fair_start_debit();
+    group_shares();
+    group_unfinished_tasks();
+    deadline_order();
+}
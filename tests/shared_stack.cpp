@@ -0,0 +1,109 @@
+#include "check.hpp"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <cosched2/scheduler.hpp>
+
+using namespace CoSched;
+
+
+
+// Tasks only take turns on shared stacks with the native backend, which sanitizers disable
+#if defined(COSCHED2_NATIVE_CONTEXT) && defined(COSCHED2_HAS_NATIVE_CONTEXT) && !defined(__SANITIZE_ADDRESS__) && !defined(__SANITIZE_THREAD__)
+static constexpr bool stacks_shared = true;
+#else
+static constexpr bool stacks_shared = false;
+#endif
+
+
+// Recurses with a buffer filled with tag in every frame, switches at the bottom and checks all buffers once back up
+template<typename Switch>
+static void fill_and_switch(unsigned char tag, unsigned depth, Switch&& do_switch) {
+    volatile unsigned char buffer[512];
+    for (auto& byte : buffer) byte = tag;
+    if (depth) fill_and_switch(tag, depth - 1, do_switch);
+    else do_switch();
+    for (auto& byte : buffer) CHECK(byte == tag);
+}
+
+static TaskOptions get_shared_options() {
+    TaskOptions fres;
+    fres.shared_stack = true;
+    return fres;
+}
+
+
+// More tasks than stacks, using their stacks to different depths and exiting at different times
+static void interleaved() {
+    Scheduler sched;
+    sched.set_shared_stacks(2, 64 * 1024);
+    std::vector<uintptr_t> addresses(6);
+    unsigned finished = 0;
+    for (unsigned index = 0; index != addresses.size(); index++) {
+        sched.create_task("task", [&, index] () {
+            const std::string name = "task " + std::to_string(index) + " with a name too long for small strings";
+            addresses[index] = reinterpret_cast<uintptr_t>(&name);
+            fill_and_switch(index + 1, index + 1, [index] () {
+                for (unsigned yields = 0; yields != index + 3; yields++) {
+                    Task::get_current().yield();
+                }
+            });
+            CHECK(name == "task " + std::to_string(index) + " with a name too long for small strings");
+            finished++;
+        }, get_shared_options());
+    }
+    sched.run();
+    CHECK(finished == addresses.size());
+    // Tasks are assigned to stacks in turns
+    if (stacks_shared) {
+        CHECK(addresses[0] == addresses[2] && addresses[2] == addresses[4]);
+        CHECK(addresses[1] == addresses[3] && addresses[3] == addresses[5]);
+        CHECK(addresses[0] != addresses[1]);
+    }
+}
+
+// Direct switches between tasks, on the same stack they fall back to a regular yield
+static void direct_switch() {
+    Scheduler sched;
+    sched.set_shared_stacks(2, 64 * 1024);
+    std::vector<Task*> tasks(4);
+    unsigned finished = 0;
+    for (unsigned index = 0; index != tasks.size(); index++) {
+        tasks[index] = &sched.create_task("task", [&, index] () {
+            fill_and_switch(0x10 + index, 2 * index, [&, index] () {
+                for (unsigned round = 0; round != 3; round++) {
+                    Task::get_current().yield_to(*tasks[(index + 1 + round) % tasks.size()]);
+                }
+            });
+            finished++;
+        }, get_shared_options());
+    }
+    sched.run();
+    CHECK(finished == tasks.size());
+}
+
+// Tasks with and without shared stack mixed
+static void mixed() {
+    Scheduler sched;
+    sched.set_shared_stacks(1, 64 * 1024);
+    unsigned finished = 0;
+    for (unsigned index = 0; index != 4; index++) {
+        sched.create_task("task", [&, index] () {
+            fill_and_switch(0x20 + index, 3, [] () {
+                Task::get_current().yield();
+                Task::get_current().yield();
+            });
+            finished++;
+        }, index % 2 ? TaskOptions() : get_shared_options());
+    }
+    sched.run();
+    CHECK(finished == 4);
+}
+
+
+int main() {
+    interleaved();
+    direct_switch();
+    mixed();
+}
@@ -0,0 +1,101 @@
+#include "check.hpp"
+
+#include <string>
+#include <vector>
+#include <cosched2/scheduler_policy.hpp>
+
+using namespace CoSched;
+
+
+
+// Spawning a task every slice MUST NOT keep the spawning task from being charged
+static void fair_spawn() {
+    BasicScheduler<FairPolicy> sched;
+    unsigned slices[2] = {}, total = 0;
+    const unsigned limit = 300;
+    for (unsigned index = 0; index != 2; index++) {
+        sched.create_task(index ? "B" : "A", [&, index] () {
+            auto& task = Task::get_current();
+            while (total < limit) {
+                if (index == 0) task.get_scheduler().spawn("child", [] () {});
+                busy_wait(std::chrono::microseconds(200));
+                slices[index]++;
+                total++;
+                task.yield();
+            }
+        });
+    }
+    sched.run();
+    CHECK(slices[0] > limit / 3);
+    CHECK(slices[1] > limit / 3);
+}
+
+// Tasks spawned to run next run ahead of others of their priority, but only a few in a row
+static void run_next_streak() {
+    Scheduler sched;
+    std::vector<std::string> order;
+    std::function<void (unsigned)> spawn_chain = [&] (unsigned depth) {
+        order.push_back(Task::get_current().get_name());
+        if (depth == 6) return;
+        Task::get_current().get_scheduler().spawn("child" + std::to_string(depth + 1), [&spawn_chain, depth] () {
+            spawn_chain(depth + 1);
+        }, {}, true);
+    };
+    sched.create_task("A", [&] () {
+        spawn_chain(0);
+    });
+    sched.create_task("B", [&] () {
+        order.push_back("B");
+    });
+    sched.run();
+    CHECK((order == std::vector<std::string>{"A", "child1", "child2", "child3", "B", "child4", "child5", "child6"}));
+}
+
+// Tasks of the highest possible priority can be run next too
+static void run_next_highest_priority() {
+    Scheduler sched;
+    std::vector<std::string> order;
+    TaskOptions options;
+    options.priority = INT8_MAX;
+    sched.create_task("A", [&] () {
+        order.push_back("A");
+        Task::get_current().get_scheduler().spawn("child", [&order] () {
+            order.push_back("child");
+        }, options, true);
+    }, options);
+    sched.create_task("B", [&] () {
+        order.push_back("B");
+    }, options);
+    sched.create_task("C", [&] () {
+        order.push_back("C");
+    });
+    sched.run();
+    CHECK((order == std::vector<std::string>{"A", "child", "B", "C"}));
+}
+
+// Tasks spawned to run next MUST be charged for their runtime like picked ones
+static void run_next_charged() {
+    BasicScheduler<FairPolicy> sched;
+    uint64_t charged = 0;
+    sched.create_task("A", [&] () {
+        auto& task = Task::get_current();
+        task.get_scheduler().spawn("child", [&charged] () {
+            auto& task = Task::get_current();
+            const uint64_t start = task.get_vruntime();
+            busy_wait(std::chrono::microseconds(2000));
+            task.yield();
+            charged = task.get_vruntime() - start;
+        }, {}, true);
+        task.yield();
+    });
+    sched.run();
+    CHECK(charged >= CycleClock::from_ns(2000000));
+}
+
+
+int main() {
+    fair_spawn();
+    run_next_streak();
+    run_next_highest_priority();
+    run_next_charged();
+}
@@ -0,0 +1,107 @@
+#include "check.hpp"
+
+#include <string>
+#include <vector>
+#include <cosched2/scheduler.hpp>
+
+using namespace CoSched;
+
+
+
+// Uses about depth kilobytes of stack, then calls at_bottom
+template<typename Fcn>
+static void use_stack(unsigned depth, Fcn&& at_bottom) {
+    volatile unsigned char buffer[1024];
+    for (auto& byte : buffer) byte = 0;
+    if (depth > 1) use_stack(depth - 1, at_bottom);
+    else at_bottom();
+    CHECK(buffer[0] == 0);
+}
+
+static TaskOptions get_options(bool shared) {
+    TaskOptions fres;
+    fres.stack_size = 256 * 1024;
+    fres.shared_stack = shared;
+    return fres;
+}
+
+
+// Peaks of exited tasks are reported by name and passed to the hook, with stacks used by other tasks not counted
+static void peaks(bool shared) {
+    Scheduler sched;
+    sched.set_stack_watermark(true);
+    sched.set_shared_stacks(1, 256 * 1024);
+    std::vector<std::pair<std::string, size_t>> hooked;
+    sched.set_stack_peak_hook([&] (const Task& task, size_t peak) {
+        hooked.emplace_back(task.get_name(), peak);
+    });
+    size_t peak_at_bottom = 0;
+    // Tasks take turns while at their deepest
+    sched.create_task("deep", [&] () {
+        use_stack(32, [&] () {
+            Task::get_current().yield();
+            peak_at_bottom = Task::get_current().get_stack_peak();
+        });
+    }, get_options(shared));
+    for (unsigned index = 0; index != 2; index++) {
+        sched.create_task("shallow", [] () {
+            use_stack(1, [] () {
+                Task::get_current().yield();
+            });
+        }, get_options(shared));
+    }
+    sched.run();
+    CHECK(peak_at_bottom >= 32 * 1024);
+    const auto& usage = sched.get_stack_usage();
+    CHECK(usage.size() == 2);
+    CHECK(usage.at("deep").get_count() == 1);
+    CHECK(usage.at("deep").get_max() >= peak_at_bottom);
+    CHECK(usage.at("shallow").get_count() == 2);
+    CHECK(usage.at("shallow").get_max() < 16 * 1024);
+    CHECK(hooked.size() == 3);
+    for (const auto& [name, peak] : hooked) {
+        if (name == "deep") CHECK(peak == usage.at("deep").get_max());
+        else CHECK(peak <= usage.at("shallow").get_max());
+    }
+}
+
+// Nothing is measured unless enabled
+static void disabled() {
+    Scheduler sched;
+    size_t peak = 1;
+    sched.create_task("task", [&] () {
+        use_stack(8, [&] () {
+            peak = Task::get_current().get_stack_peak();
+        });
+    });
+    sched.run();
+    CHECK(peak == 0);
+    CHECK(sched.get_stack_usage().empty());
+}
+
+// Percentiles are bucketed but never exceed the exact maximum
+static void percentiles() {
+    StackUsage usage;
+    CHECK(usage.get_percentile(0.5) == 0);
+    for (unsigned index = 0; index != 9; index++) usage.record(1000);
+    usage.record(50000);
+    CHECK(usage.get_count() == 10);
+    CHECK(usage.get_max() == 50000);
+    CHECK(usage.get_percentile(0.5) >= 1000 && usage.get_percentile(0.5) <= 1000 + 1000 / 16);
+    CHECK(usage.get_percentile(0.9) == usage.get_percentile(0.5));
+    CHECK(usage.get_percentile(1.0) == 50000);
+    StackUsage other;
+    other.record(70000);
+    usage += other;
+    CHECK(usage.get_count() == 11);
+    CHECK(usage.get_max() == 70000);
+    CHECK(usage.get_percentile(1.0) == 70000);
+}
+
+
+int main() {
+    peaks(false);
+    peaks(true);
+    disabled();
+    percentiles();
+}
@@ -0,0 +1,56 @@
+#include "check.hpp"
+
+#include <string>
+#include <vector>
+#include <cosched2/scheduled_thread.hpp>
+#include <cosched2/stackless.hpp>
+
+using namespace CoSched;
+
+
+
+// Lambda coroutines refer to their captures through the factory, which has to outlive the frame
+static void factory_captures() {
+    std::vector<std::string> names;
+    ScheduledThread thread;
+    for (const char *name : {"A", "B"}) {
+        thread.create_stackless_task(name, [&names, name = std::string(name) + " with a name too long for small strings"] () -> Stackless {
+            co_await yield();
+            names.push_back(name);
+            co_await yield();
+            names.push_back(name);
+        });
+    }
+    thread.start();
+    thread.wait();
+    CHECK(names.size() == 4);
+    CHECK(names[0] == "A with a name too long for small strings");
+    CHECK(names[1] == "B with a name too long for small strings");
+}
+
+// Stackless and stackful tasks are run in turns
+static void mixed() {
+    std::vector<std::string> order;
+    ScheduledThread thread;
+    thread.create_stackless_task("stackless", [&] () -> Stackless {
+        for (unsigned index = 0; index != 2; index++) {
+            order.push_back("stackless");
+            co_await yield();
+        }
+    });
+    thread.create_task("stackful", [&] () {
+        for (unsigned index = 0; index != 2; index++) {
+            order.push_back("stackful");
+            Task::get_current().yield();
+        }
+    });
+    thread.start();
+    thread.wait();
+    CHECK((order == std::vector<std::string>{"stackless", "stackful", "stackless", "stackful"}));
+}
+
+
+int main() {
+    factory_captures();
+    mixed();
+}
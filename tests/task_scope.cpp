@@ -0,0 +1,123 @@
+#include "check.hpp"
+
+#include <cosched2/scheduler.hpp>
+#include <cosched2/scheduler_mutex.hpp>
+#include <cosched2/task_scope.hpp>
+
+using namespace CoSched;
+
+
+
+// Keeps yielding until terminated
+static void yield_until_terminated(bool& done) {
+    while (Task::get_current().yield());
+    done = true;
+}
+
+
+// Waiting returns once all tasks in the scope have finished, leaving the scope waits as well
+static void wait_for_tasks() {
+    Scheduler sched;
+    unsigned finished = 0, finished_at_wait = 0, finished_at_exit = 0;
+    sched.create_task("owner", [&] () {
+        {
+            TaskScope scope;
+            for (unsigned index = 0; index != 3; index++) {
+                scope.spawn("child", [&finished, index] () {
+                    for (unsigned yields = 0; yields != index + 1; yields++) Task::get_current().yield();
+                    finished++;
+                });
+            }
+            scope.wait();
+            finished_at_wait = finished;
+            CHECK(scope.get_tasks().empty());
+            scope.spawn("late", [&finished] () {
+                Task::get_current().yield();
+                finished++;
+            });
+        }
+        finished_at_exit = finished;
+    });
+    sched.run();
+    CHECK(finished_at_wait == 3);
+    CHECK(finished_at_exit == 4);
+}
+
+// Terminating the owner cancels its scope, reaching tasks in scopes owned by the tasks in it too
+static void cancel_nested() {
+    Scheduler sched;
+    bool child_done = false, grandchild_done = false, owner_done = false;
+    Task *owner = nullptr;
+    owner = &sched.create_task("owner", [&] () {
+        {
+            TaskScope scope;
+            scope.spawn("child", [&] () {
+                TaskScope scope;
+                scope.spawn("grandchild", [&] () {
+                    yield_until_terminated(grandchild_done);
+                });
+                yield_until_terminated(child_done);
+            });
+        }
+        owner_done = true;
+    });
+    sched.create_task("canceller", [&] () {
+        for (unsigned yields = 0; yields != 10; yields++) Task::get_current().yield();
+        CHECK(!child_done && !grandchild_done);
+        owner->terminate();
+    });
+    sched.run();
+    CHECK(child_done && grandchild_done && owner_done);
+}
+
+// Cancelling a scope wakes its tasks up from waits
+static void cancel_parked() {
+    Scheduler sched;
+    Mutex mutex;
+    bool cancelled = false;
+    sched.create_task("holder", [&] () {
+        auto guard = mutex.lock();
+        TaskScope scope;
+        scope.spawn("waiter", [&] () {
+            auto guard = mutex.lock();
+            cancelled = guard.is_cancelled();
+        });
+        Task::get_current().yield();
+        scope.cancel();
+        CHECK(scope.is_cancelled());
+    });
+    sched.run();
+    CHECK(cancelled);
+}
+
+// Tasks reach scopes owned by tasks on shared stacks while those aren't resident
+static void shared_stack_owner() {
+    Scheduler sched;
+    sched.set_shared_stacks(1, 64 * 1024);
+    TaskOptions options;
+    options.shared_stack = true;
+    unsigned finished = 0;
+    for (unsigned index = 0; index != 2; index++) {
+        sched.create_task("owner", [&] () {
+            TaskScope scope;
+            for (unsigned child = 0; child != 4; child++) {
+                scope.spawn("child", [&finished, child] () {
+                    for (unsigned yields = 0; yields != child + 1; yields++) Task::get_current().yield();
+                    finished++;
+                });
+            }
+            scope.wait();
+            CHECK(scope.get_tasks().empty());
+        }, options);
+    }
+    sched.run();
+    CHECK(finished == 8);
+}
+
+
+int main() {
+    wait_for_tasks();
+    cancel_nested();
+    cancel_parked();
+    shared_stack_owner();
+}
@@ -0,0 +1,61 @@
+#include "check.hpp"
+
+#include <cosched2/scheduler.hpp>
+#include <cosched2/scheduler_mutex.hpp>
+
+using namespace CoSched;
+
+
+
+// Tasks taking turns are charged their own runs and the runs of the other while ready
+static void run_and_ready() {
+    Scheduler sched;
+    unsigned checked = 0;
+    for (const char *name : {"A", "B"}) {
+        sched.create_task(name, [&] () {
+            auto& task = Task::get_current();
+            for (unsigned round = 0; round != 3; round++) {
+                busy_wait(std::chrono::microseconds(1000));
+                task.yield();
+            }
+            const auto& stats = task.get_stats();
+            // Launch and resume after every yield, including the current run
+            CHECK(stats.resumes == 4);
+            CHECK(stats.run_time >= CycleClock::from_ns(3000000));
+            CHECK(stats.longest_run >= CycleClock::from_ns(1000000));
+            CHECK(stats.longest_run <= stats.run_time);
+            CHECK(stats.ready_time >= CycleClock::from_ns(3000000));
+            CHECK(stats.wait_time == 0);
+            checked++;
+        });
+    }
+    sched.run();
+    CHECK(checked == 2);
+}
+
+// Time spent parked on a mutex is charged as wait time, not as ready time
+static void wait_time() {
+    Scheduler sched;
+    Mutex mutex;
+    bool checked = false;
+    sched.create_task("holder", [&] () {
+        auto guard = mutex.lock();
+        Task::get_current().yield();
+        busy_wait(std::chrono::microseconds(2000));
+    });
+    sched.create_task("waiter", [&] () {
+        auto guard = mutex.lock();
+        const auto& stats = Task::get_current().get_stats();
+        CHECK(stats.wait_time >= CycleClock::from_ns(2000000));
+        CHECK(stats.ready_time < CycleClock::from_ns(2000000));
+        checked = true;
+    });
+    sched.run();
+    CHECK(checked);
+}
+
+
+int main() {
+    run_and_ready();
+    wait_time();
+}
@@ -0,0 +1,110 @@
+#include "check.hpp"
+
+#include <string>
+#include <vector>
+#include <cosched2/scheduler_mutex.hpp>
+
+using namespace CoSched;
+
+
+
+// Spins through units of work, giving way whenever its time slice is used up and somebody else has to run
+// Returns the amount of units done when given task started running
+struct Spinner {
+    unsigned done = 0, limit = 2000;
+
+    void run() {
+        while (done != limit) {
+            busy_wait(std::chrono::microseconds(5));
+            done++;
+            Task::get_current().yield_if_needed();
+        }
+    }
+};
+
+static TaskOptions get_spinner_options() {
+    TaskOptions fres;
+    fres.time_slice = std::chrono::microseconds(100);
+    return fres;
+}
+
+
+// Time slice starts on every resume, termination asks to yield right away
+static void should_yield() {
+    Scheduler sched;
+    sched.create_task("task", [] () {
+        auto& task = Task::get_current();
+        CHECK(!task.should_yield());
+        busy_wait(std::chrono::microseconds(200));
+        CHECK(task.should_yield());
+        // Nobody else to run, slice is renewed without switching
+        const auto switches = task.get_scheduler().get_switches();
+        CHECK(task.yield_if_needed());
+        CHECK(!task.should_yield());
+        CHECK(task.get_scheduler().get_switches() == switches);
+        task.terminate();
+        CHECK(task.should_yield());
+    }, get_spinner_options());
+    sched.run();
+}
+
+// Tasks spawned by a spinning task get to run once its slice is used up
+static void spawned_task() {
+    Scheduler sched;
+    Spinner spinner;
+    unsigned done_at_child = 0;
+    sched.create_task("spinner", [&] () {
+        Task::get_current().get_scheduler().spawn("child", [&] () {
+            done_at_child = spinner.done;
+        });
+        spinner.run();
+    }, get_spinner_options());
+    sched.run();
+    CHECK(done_at_child != 0 && done_at_child < spinner.limit);
+}
+
+// Tasks woken up by a spinning task get to run once its slice is used up
+static void woken_task() {
+    Scheduler sched;
+    Mutex mutex;
+    Spinner spinner;
+    unsigned done_at_waiter = 0;
+    sched.create_task("spinner", [&] () {
+        {
+            auto guard = mutex.lock();
+            Task::get_current().yield();
+        }
+        spinner.run();
+    }, get_spinner_options());
+    sched.create_task("waiter", [&] () {
+        auto guard = mutex.lock();
+        done_at_waiter = spinner.done;
+    });
+    sched.run();
+    CHECK(done_at_waiter < spinner.limit);
+}
+
+// Ready tasks of lower priority don't keep a task from renewing its slice with strict priorities
+static void lower_priority() {
+    Scheduler sched;
+    Spinner spinner;
+    unsigned done_at_low = 0;
+    TaskOptions options = get_spinner_options();
+    options.priority = PRIO_HIGH;
+    sched.create_task("spinner", [&] () {
+        spinner.run();
+    }, options);
+    sched.create_task("low", [&] () {
+        done_at_low = spinner.done;
+    });
+    sched.run();
+    CHECK(done_at_low == spinner.limit);
+}
+
+
+int main() {
+    should_yield();
+    spawned_task();
+    woken_task();
+    lower_priority();
+}
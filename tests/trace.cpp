@@ -0,0 +1,137 @@
+#include "check.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <cosched2/trace.hpp>
+#include <cosched2/scheduler_mutex.hpp>
+
+using namespace CoSched;
+
+
+
+static bool contains(const std::string& text, const std::string& part) {
+    return text.find(part) != std::string::npos;
+}
+
+
+// Only the newest events are kept once the buffer is full
+static void ring_buffer() {
+    TraceBuffer buffer;
+    buffer.set_capacity(5);
+    CHECK(buffer.get_capacity() == 8);
+    CHECK(buffer.get_events().empty());
+    buffer.set_enabled(true);
+    for (uint64_t index = 0; index != 20; index++) {
+        buffer.record(TraceEventType::resume, index % 3, index);
+    }
+    buffer.record(TraceEventType::spawn, 7, 20, nullptr, "a name too long to be kept");
+    const auto events = buffer.get_events();
+    CHECK(events.size() == 8);
+    for (unsigned index = 0; index != events.size(); index++) {
+        CHECK(events[index].timestamp == index + 13);
+    }
+    CHECK(events.back().type == TraceEventType::spawn && events.back().task_id == 7);
+    CHECK(std::strcmp(events.back().name, "a name too long ") == 0);
+}
+
+// Scheduler traces the life of its tasks, including waits on the object waited on
+static void scheduler_events() {
+    Scheduler sched;
+    sched.get_trace_buffer().set_enabled(true);
+    Mutex mutex;
+    const auto& holder = sched.create_task("holder", [&] () {
+        auto guard = mutex.lock();
+        Task::get_current().yield();
+    });
+    const auto& waiter = sched.create_task("waiter", [&] () {
+        auto guard = mutex.lock();
+    });
+    const uint64_t holder_id = holder.get_id(), waiter_id = waiter.get_id();
+    sched.run();
+    const auto events = sched.get_trace_buffer().get_events();
+    CHECK(std::is_sorted(events.begin(), events.end(), [] (const TraceEvent& a, const TraceEvent& b) {
+        return a.timestamp < b.timestamp;
+    }));
+    const auto get_types = [&] (uint64_t task_id) {
+        std::vector<TraceEventType> fres;
+        for (const auto& event : events) {
+            if (event.task_id != task_id) continue;
+            fres.push_back(event.type);
+            if (event.type == TraceEventType::wait || event.type == TraceEventType::wake) CHECK(event.object == reinterpret_cast<uintptr_t>(&mutex));
+            if (event.type == TraceEventType::spawn) CHECK(std::strcmp(event.name, task_id == holder_id ? "holder" : "waiter") == 0);
+        }
+        return fres;
+    };
+    using T = TraceEventType;
+    CHECK((get_types(holder_id) == std::vector<T>{T::spawn, T::resume, T::yield, T::resume, T::exit}));
+    CHECK((get_types(waiter_id) == std::vector<T>{T::spawn, T::resume, T::wait, T::suspend, T::wake, T::resume, T::exit}));
+}
+
+// Runs become complete events and waits async slices on a thread per scheduler
+static void render() {
+    Scheduler sched;
+    TraceExporter exporter;
+    exporter.add("thread \"one\"", sched);
+    exporter.set_enabled(true);
+    CHECK(sched.get_trace_buffer().is_enabled());
+    Mutex mutex;
+    sched.create_task("holder", [&] () {
+        auto guard = mutex.lock();
+        Task::get_current().yield();
+    });
+    sched.create_task("waiter", [&] () {
+        auto guard = mutex.lock();
+    });
+    sched.run();
+    exporter.set_enabled(false);
+    const auto rendered = exporter.render();
+    CHECK(rendered.rfind("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[", 0) == 0);
+    CHECK(contains(rendered, "\n]}\n"));
+    CHECK(contains(rendered, "\"name\":\"thread_name\",\"args\":{\"name\":\"thread \\\"one\\\"\"}"));
+    CHECK(contains(rendered, "\"name\":\"spawn\",\"args\":{\"task\":"));
+    CHECK(contains(rendered, "\"name\":\"holder\",\"args\":{\"task\":"));
+    CHECK(contains(rendered, "\"stop\":\"yield\""));
+    CHECK(contains(rendered, "\"stop\":\"suspend\""));
+    CHECK(contains(rendered, "\"stop\":\"exit\""));
+    CHECK(contains(rendered, "{\"ph\":\"b\",\"pid\":1,\"tid\":1,"));
+    CHECK(contains(rendered, "{\"ph\":\"e\",\"pid\":1,\"tid\":1,"));
+    CHECK(contains(rendered, "\"cat\":\"wait\",\"name\":\"wait waiter\""));
+    CHECK(std::count(rendered.begin(), rendered.end(), '{') == std::count(rendered.begin(), rendered.end(), '}'));
+    CHECK(std::count(rendered.begin(), rendered.end(), '[') == std::count(rendered.begin(), rendered.end(), ']'));
+}
+
+// Tasks whose spawn has been overwritten are named after their ID
+static void unknown_names() {
+    Scheduler sched;
+    sched.get_trace_buffer().set_capacity(4);
+    TraceExporter exporter;
+    exporter.add("sched", sched);
+    exporter.set_enabled(true);
+    uint64_t id = 0;
+    sched.create_task("task", [&] () {
+        id = Task::get_current().get_id();
+        for (unsigned yields = 0; yields != 4; yields++) {
+            Task::get_current().yield();
+        }
+    });
+    sched.create_task("other", [] () {
+        for (unsigned yields = 0; yields != 4; yields++) {
+            Task::get_current().yield();
+        }
+    });
+    sched.run();
+    const auto rendered = exporter.render();
+    CHECK(sched.get_trace_buffer().get_events().size() == 4);
+    CHECK(!contains(rendered, "\"name\":\"spawn\""));
+    CHECK(contains(rendered, "\"name\":\"Task " + std::to_string(id) + "\""));
+}
+
+
+int main() {
+    ring_buffer();
+    scheduler_events();
+    render();
+    unknown_names();
+}
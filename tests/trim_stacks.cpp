@@ -0,0 +1,121 @@
+#include "check.hpp"
+
+#include <cstdint>
+#include <vector>
+#include <cosched2/metrics.hpp>
+#include <cosched2/scheduler.hpp>
+#include <cosched2/scheduler_mutex.hpp>
+#if defined(__linux__)
+#   include <sys/mman.h>
+#   include <unistd.h>
+#endif
+
+using namespace CoSched;
+
+
+
+// Saved stack pointers can only be found with assembly context switches, which sanitizers disable
+#if defined(__linux__) && (defined(__x86_64__) || defined(__aarch64__)) && !defined(__SANITIZE_ADDRESS__) && !defined(__SANITIZE_THREAD__)
+static constexpr bool stacks_trimmable = true;
+
+static bool is_resident(uintptr_t address) {
+    const uintptr_t page_size = sysconf(_SC_PAGESIZE);
+    unsigned char resident = 0;
+    CHECK(mincore(reinterpret_cast<void*>(address & ~(page_size - 1)), page_size, &resident) == 0);
+    return resident & 1;
+}
+#else
+static constexpr bool stacks_trimmable = false;
+
+static bool is_resident(uintptr_t) {
+    return true;
+}
+#endif
+
+
+// Uses about depth kilobytes of stack and returns the address of the deepest frame
+static uintptr_t use_stack(unsigned depth) {
+    volatile unsigned char buffer[1024];
+    for (auto& byte : buffer) byte = 1;
+    const uintptr_t fres = depth > 1 ? use_stack(depth - 1) : reinterpret_cast<uintptr_t>(&buffer[0]);
+    CHECK(buffer[0] == 1 && buffer[sizeof(buffer) - 1] == 1);
+    return fres;
+}
+
+static TaskOptions get_options() {
+    TaskOptions fres;
+    fres.stack_size = 256 * 1024;
+    return fres;
+}
+
+
+// Resident pages below the saved stack pointer of parked tasks are given back once per stop
+static void parked_task() {
+    Scheduler sched;
+    Mutex mutex;
+    uintptr_t parked_deep = 0, parked_here = 0, ready_deep = 0;
+    bool checked = false;
+    sched.create_task("holder", [&] () {
+        auto guard = mutex.lock();
+        while (!parked_deep || !ready_deep) Task::get_current().yield();
+        // Tasks parked for less than min_parked are left alone
+        CHECK(sched.trim_stacks(std::chrono::hours(1)) == 0);
+        CHECK(is_resident(parked_deep));
+        const size_t trimmed = sched.trim_stacks(std::chrono::nanoseconds(0));
+        if (stacks_trimmable) {
+            CHECK(trimmed >= 48 * 1024);
+            CHECK(!is_resident(parked_deep));
+            CHECK(is_resident(parked_here));
+        } else {
+            CHECK(trimmed == 0);
+        }
+        CHECK(sched.get_metrics().stack_bytes_trimmed == trimmed);
+        // Ready tasks are left alone, as are parked ones that haven't run since
+        CHECK(is_resident(ready_deep));
+        CHECK(sched.trim_stacks(std::chrono::nanoseconds(0)) == 0);
+        checked = true;
+    });
+    sched.create_task("parked", [&] () {
+        parked_deep = use_stack(64);
+        volatile unsigned char here = 1;
+        parked_here = reinterpret_cast<uintptr_t>(&here);
+        {
+            auto guard = mutex.lock();
+        }
+        // Trimmed pages are faulted back in once needed
+        CHECK(use_stack(64) == parked_deep);
+        CHECK(here == 1);
+    }, get_options());
+    sched.create_task("ready", [&] () {
+        ready_deep = use_stack(64);
+        while (!checked) Task::get_current().yield();
+    }, get_options());
+    sched.run();
+    CHECK(checked);
+}
+
+// Watermarked stacks are never trimmed, they have to stay filled to be measured
+static void watermarked_task() {
+    Scheduler sched;
+    sched.set_stack_watermark(true);
+    Mutex mutex;
+    uintptr_t parked_deep = 0;
+    sched.create_task("holder", [&] () {
+        auto guard = mutex.lock();
+        while (!parked_deep) Task::get_current().yield();
+        CHECK(sched.trim_stacks(std::chrono::nanoseconds(0)) == 0);
+        CHECK(is_resident(parked_deep));
+    });
+    sched.create_task("parked", [&] () {
+        parked_deep = use_stack(64);
+        auto guard = mutex.lock();
+    }, get_options());
+    sched.run();
+    CHECK(sched.get_stack_usage().at("parked").get_max() >= 64 * 1024);
+}
+
+
+int main() {
+    parked_task();
+    watermarked_task();
+}
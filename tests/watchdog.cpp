@@ -0,0 +1,75 @@
+#include "check.hpp"
+
+#include <mutex>
+#include <vector>
+#include <cosched2/watchdog.hpp>
+
+using namespace CoSched;
+
+
+
+// Runs a task on a watched scheduling thread and returns what has been reported about it
+template<typename Fcn>
+static std::vector<HungTaskReport> watch(Fcn&& task_fcn) {
+    std::mutex mutex;
+    std::vector<HungTaskReport> fres;
+    ScheduledThread thread;
+    thread.start();
+    Watchdog watchdog(std::chrono::milliseconds(50), [&] (const HungTaskReport& report) {
+        std::scoped_lock L(mutex);
+        fres.push_back(report);
+    });
+    watchdog.add("watched", thread);
+    watchdog.start();
+    thread.create_task("task", std::move(task_fcn));
+    thread.wait();
+    watchdog.stop();
+    return fres;
+}
+
+
+// Tasks that keep yielding MUST NOT be reported, even if there is nothing else to switch to
+static void skipped_yields() {
+    const auto reports = watch([] () {
+        auto& task = Task::get_current();
+        const auto until = std::chrono::steady_clock::now() + std::chrono::milliseconds(300);
+        while (std::chrono::steady_clock::now() < until) {
+            busy_wait(std::chrono::microseconds(1000));
+            task.yield();
+        }
+        CHECK(task.get_scheduler().get_skipped_switches() >= 100);
+    });
+    CHECK(reports.empty());
+}
+
+// Neither may tasks that give way whenever their time slice is used up
+static void skipped_time_slices() {
+    const auto reports = watch([] () {
+        auto& task = Task::get_current();
+        task.set_time_slice(std::chrono::milliseconds(1));
+        const auto until = std::chrono::steady_clock::now() + std::chrono::milliseconds(300);
+        while (std::chrono::steady_clock::now() < until) {
+            busy_wait(std::chrono::microseconds(100));
+            task.yield_if_needed();
+        }
+    });
+    CHECK(reports.empty());
+}
+
+// Tasks that don't yield are reported once per hang
+static void hang() {
+    const auto reports = watch([] () {
+        busy_wait(std::chrono::microseconds(300000));
+    });
+    CHECK(reports.size() == 1);
+    CHECK(reports[0].scheduler == "watched");
+    CHECK(reports[0].running_for >= std::chrono::milliseconds(50));
+    CHECK(reports[0].in_task && reports[0].task_name == "task");
+}
+
+
+int main() {
+    skipped_yields();
+    skipped_time_slices();
+    hang();
+}
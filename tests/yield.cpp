@@ -0,0 +1,100 @@
+#include "check.hpp"
+
+#include <string>
+#include <vector>
+#include <cosched2/scheduler_policy.hpp>
+
+using namespace CoSched;
+
+
+
+// Yields without anything else to run return right away and are counted as skipped
+static void skipped_alone() {
+    Scheduler sched;
+    sched.create_task("task", [] () {
+        auto& task = Task::get_current();
+        auto& scheduler = task.get_scheduler();
+        const auto switches = scheduler.get_switches();
+        for (unsigned index = 0; index != 100; index++) {
+            CHECK(task.yield());
+        }
+        CHECK(scheduler.get_switches() == switches);
+        CHECK(scheduler.get_skipped_switches() == 100);
+    });
+    sched.run();
+}
+
+// Tasks with competition switch on every yield, only the one left skips
+static void switched_with_competition() {
+    Scheduler sched;
+    std::vector<std::string> order;
+    for (const char *name : {"A", "B"}) {
+        sched.create_task(name, [&, name] () {
+            auto& task = Task::get_current();
+            for (unsigned index = 0; index != (name[0] == 'A' ? 4 : 2); index++) {
+                order.push_back(name);
+                CHECK(task.yield());
+            }
+        });
+    }
+    sched.run();
+    CHECK((order == std::vector<std::string>{"A", "B", "A", "B", "A", "A"}));
+    CHECK(sched.get_skipped_switches() == 1);
+}
+
+// Tasks woken up or spawned since the last switch are competition as well, even before the policy knows about them
+static void switched_for_new_tasks() {
+    Scheduler sched;
+    Task *sleeper = nullptr;
+    bool woken = false, spawned = false;
+    sleeper = &sched.create_task("sleeper", [&] () {
+        auto& task = Task::get_current();
+        task.set_suspended(true);
+        task.yield();
+        woken = true;
+    });
+    sched.create_task("task", [&] () {
+        auto& task = Task::get_current();
+        sleeper->set_suspended(false);
+        task.yield();
+        CHECK(woken);
+        task.get_scheduler().spawn("child", [&] () {
+            spawned = true;
+        });
+        task.yield();
+        CHECK(spawned);
+    });
+    sched.run();
+    CHECK(sched.get_skipped_switches() == 0);
+}
+
+// Ready tasks of lower priority only count as competition if the policy doesn't use strict priorities
+template<class Policy>
+static uint64_t count_skips_above_low_priority() {
+    BasicScheduler<Policy> sched;
+    TaskOptions options;
+    options.priority = PRIO_HIGH;
+    sched.create_task("high", [] () {
+        for (unsigned index = 0; index != 10; index++) {
+            Task::get_current().yield();
+        }
+    }, options);
+    options.priority = PRIO_LOW;
+    sched.create_task("low", [] () {}, options);
+    // Run high priority task until it is done, low one doesn't get to run in between with strict priorities
+    sched.run_once();
+    return sched.get_skipped_switches();
+}
+
+static void lower_priority() {
+    CHECK(count_skips_above_low_priority<PriorityPolicy>() == 10);
+    CHECK(count_skips_above_low_priority<FairPolicy>() == 0);
+}
+
+
+int main() {
+    skipped_alone();
+    switched_with_competition();
+    switched_for_new_tasks();
+    lower_priority();
+}
@@ -0,0 +1,194 @@
+#include "check.hpp"
+
+#include <cosched2/scheduler_policy.hpp>
+
+using namespace CoSched;
+
+
+
+// Yielder switches to worker directly after every slice, worker works three times as long per slice
+// Returns the time each has been working for and the virtual runtime they have been charged for it
+struct YieldToRun {
+    uint64_t work_ns[2] = {};
+    uint64_t vruntime[2] = {};
+};
+
+// Returns the time actually spent, which includes time the thread has been preempted for
+static uint64_t work(std::chrono::microseconds duration) {
+    const auto start = std::chrono::steady_clock::now();
+    busy_wait(duration);
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+template<class Policy>
+static YieldToRun run_yielder_and_worker(BasicScheduler<Policy>& sched, const TaskOptions& yielder_options = {}, const TaskOptions& worker_options = {}) {
+    YieldToRun fres;
+    bool done = false;
+    Task *worker = nullptr;
+    sched.create_task("yielder", [&] () {
+        auto& task = Task::get_current();
+        const auto start_vruntime = task.get_vruntime();
+        for (unsigned slice = 0; slice != 100; slice++) {
+            fres.work_ns[0] += work(std::chrono::microseconds(100));
+            task.yield_to(*worker);
+        }
+        done = true;
+        fres.vruntime[0] = task.get_vruntime() - start_vruntime;
+    }, yielder_options);
+    worker = &sched.create_task("worker", [&] () {
+        auto& task = Task::get_current();
+        const auto start_vruntime = task.get_vruntime();
+        while (!done) {
+            fres.work_ns[1] += work(std::chrono::microseconds(300));
+            task.yield();
+        }
+        fres.vruntime[1] = task.get_vruntime() - start_vruntime;
+    }, worker_options);
+    sched.run();
+    return fres;
+}
+
+// Checks if a and b are in about the same ratio as c and d
+static bool about_same_ratio(uint64_t a, uint64_t b, uint64_t c, uint64_t d) {
+    const double ratio = (double(a) / double(b)) / (double(c) / double(d));
+    return ratio > 0.6 && ratio < 1.6;
+}
+
+// Tasks switched to directly are charged for their runtime, the task switching to them isn't
+static void fair_accounting() {
+    BasicScheduler<FairPolicy> sched;
+    const auto run = run_yielder_and_worker(sched);
+    CHECK(about_same_ratio(run.vruntime[1], run.vruntime[0], run.work_ns[1], run.work_ns[0]));
+}
+
+static void group_accounting() {
+    TaskGroup yielder_group("yielder"), worker_group("worker");
+    BasicScheduler<GroupPolicy> sched;
+    TaskOptions yielder_options, worker_options;
+    yielder_options.group = &yielder_group;
+    worker_options.group = &worker_group;
+    const auto run = run_yielder_and_worker(sched, yielder_options, worker_options);
+    CHECK(about_same_ratio(run.vruntime[1], run.vruntime[0], run.work_ns[1], run.work_ns[0]));
+    CHECK(about_same_ratio(worker_group.get_runtime_ns(), yielder_group.get_runtime_ns(), run.work_ns[1], run.work_ns[0]));
+}
+
+
+// Target exits right after having been switched to, it MUST NOT be left behind in the policy
+template<class Policy>
+static void target_exits() {
+    BasicScheduler<Policy> sched;
+    bool started = false, switched = false, exited = false, resumed = false;
+    auto& target = sched.create_task("target", [&] () {
+        started = true;
+        while (!switched) Task::get_current().yield();
+        exited = true;
+    });
+    sched.create_task("yielder", [&] () {
+        auto& task = Task::get_current();
+        while (!started) task.yield();
+        switched = true;
+        CHECK(task.yield_to(target));
+        resumed = true;
+    });
+    sched.run();
+    CHECK(exited);
+    CHECK(resumed);
+}
+
+// Task switched to directly switches on to a task that exits, both switching tasks are resumed by the scheduler
+template<class Policy>
+static void chain_exits() {
+    BasicScheduler<Policy> sched;
+    unsigned started = 0, resumed = 0;
+    bool middle_switched = false, last_switched = false, exited = false;
+    auto& last = sched.create_task("last", [&] () {
+        started++;
+        while (!last_switched) Task::get_current().yield();
+        exited = true;
+    });
+    auto& middle = sched.create_task("middle", [&] () {
+        auto& task = Task::get_current();
+        started++;
+        while (!middle_switched) task.yield();
+        last_switched = true;
+        CHECK(task.yield_to(last));
+        resumed++;
+    });
+    sched.create_task("first", [&] () {
+        auto& task = Task::get_current();
+        while (started != 2) task.yield();
+        middle_switched = true;
+        CHECK(task.yield_to(middle));
+        resumed++;
+    });
+    sched.run();
+    CHECK(exited);
+    CHECK(resumed == 2);
+}
+
+// Task switching away is terminated by its target, yield_to() returns false once it is back
+template<class Policy>
+static void yielder_terminated() {
+    BasicScheduler<Policy> sched;
+    Task *yielder = nullptr;
+    bool started = false, switched = false, resumed = false;
+    auto& target = sched.create_task("target", [&] () {
+        started = true;
+        while (!switched) Task::get_current().yield();
+        yielder->terminate();
+    });
+    yielder = &sched.create_task("yielder", [&] () {
+        auto& task = Task::get_current();
+        while (!started) task.yield();
+        switched = true;
+        // Falling back to a regular yield, we may be resumed before target has run
+        while (task.yield_to(target));
+        resumed = true;
+    });
+    sched.run();
+    CHECK(resumed);
+}
+
+// Targets that can't be switched to directly fall back to a regular yield
+template<class Policy>
+static void fallback() {
+    BasicScheduler<Policy> sched;
+    bool target_ran = false, suspended_ran = false;
+    auto& suspended = sched.create_task("suspended", [&] () {
+        suspended_ran = true;
+    });
+    suspended.set_suspended(true);
+    sched.create_task("yielder", [&] () {
+        auto& task = Task::get_current();
+        // Spawned tasks aren't started until we yield, target is gone once it has run
+        CHECK(task.yield_to(task.get_scheduler().spawn("not started", [&] () {
+            target_ran = true;
+        })));
+        while (!target_ran) task.yield();
+        CHECK(task.yield_to(task));
+        CHECK(task.yield_to(suspended));
+        CHECK(!suspended_ran);
+        suspended.set_suspended(false);
+    });
+    sched.run();
+    CHECK(suspended_ran);
+}
+
+
+template<class Policy>
+static void exit_paths() {
+    target_exits<Policy>();
+    chain_exits<Policy>();
+    yielder_terminated<Policy>();
+    fallback<Policy>();
+}
+
+
+int main() {
+    fair_accounting();
+    group_accounting();
+    exit_paths<PriorityPolicy>();
+    exit_paths<FairPolicy>();
+    exit_paths<GroupPolicy>();
+    exit_paths<DeadlinePolicy<FairPolicy>>();
+}
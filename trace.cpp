@@ -0,0 +1,129 @@
+#include "cosched2/trace.hpp"
+
+#include <cstdio>
+#include <fstream>
+#include <unordered_map>
+
+
+
+namespace CoSched {
+namespace {
+void append_json_string(std::string& out, std::string_view value) {
+    out += '"';
+    for (const char c : value) {
+        switch (c) {
+        case '\\': out += "\\\\"; break;
+        case '"': out += "\\\""; break;
+        case '\n': out += "\\n"; break;
+        default:
+            if (static_cast<unsigned char>(c) < 0x20) {
+                char buf[8];
+                std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+                out += buf;
+            } else {
+                out += c;
+            }
+        }
+    }
+    out += '"';
+}
+
+std::string format_us(uint64_t ticks) {
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "%.3f", static_cast<double>(CycleClock::to_ns(ticks)) / 1000.0);
+    return buf;
+}
+}
+
+std::string TraceExporter::render() const {
+    std::vector<std::vector<TraceEvent>> events;
+    events.reserve(sources.size());
+    uint64_t start = UINT64_MAX;
+    for (const auto& source : sources) {
+        events.push_back(source.scheduler->get_trace_buffer().get_events());
+        if (!events.back().empty()) start = std::min(start, events.back().front().timestamp);
+    }
+    std::string fres = "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+    bool first = true;
+    // Begins an event on thread of given scheduler, rest of it is up to the caller
+    const auto begin_event = [&] (const char *phase, size_t tid, uint64_t timestamp) {
+        if (!first) fres += ',';
+        first = false;
+        fres += "\n{\"ph\":\""; fres += phase;
+        fres += "\",\"pid\":1,\"tid\":"; fres += std::to_string(tid);
+        fres += ",\"ts\":"; fres += format_us(timestamp - start);
+    };
+    for (size_t index = 0; index != sources.size(); index++) {
+        const size_t tid = index + 1;
+        begin_event("M", tid, start);
+        fres += ",\"name\":\"thread_name\",\"args\":{\"name\":";
+        append_json_string(fres, sources[index].name);
+        fres += "}}";
+        // Names are only known for tasks spawned while their spawn event is still in the buffer
+        std::unordered_map<uint64_t, std::string> names;
+        const auto get_name = [&] (uint64_t task_id) {
+            auto res = names.find(task_id);
+            if (res != names.end()) return res->second;
+            return "Task " + std::to_string(task_id);
+        };
+        // Task runs become complete events
+        bool running = false;
+        uint64_t running_task = 0, running_since = 0;
+        const auto end_run = [&] (uint64_t timestamp, const char *reason) {
+            if (!running) return;
+            running = false;
+            begin_event("X", tid, running_since);
+            fres += ",\"dur\":"; fres += format_us(timestamp - running_since);
+            fres += ",\"name\":"; append_json_string(fres, get_name(running_task));
+            fres += ",\"args\":{\"task\":"; fres += std::to_string(running_task);
+            fres += ",\"stop\":\""; fres += reason; fres += "\"}}";
+        };
+        for (const auto& event : events[index]) {
+            switch (event.type) {
+            case TraceEventType::spawn: {
+                names[event.task_id] = event.name;
+                begin_event("i", tid, event.timestamp);
+                fres += ",\"s\":\"t\",\"name\":\"spawn\",\"args\":{\"task\":"; fres += std::to_string(event.task_id);
+                fres += ",\"name\":"; append_json_string(fres, event.name); fres += "}}";
+            } break;
+            case TraceEventType::resume: {
+                end_run(event.timestamp, "switched");
+                running = true;
+                running_task = event.task_id;
+                running_since = event.timestamp;
+            } break;
+            case TraceEventType::yield:
+            case TraceEventType::suspend: {
+                if (running && running_task == event.task_id) end_run(event.timestamp, event.type == TraceEventType::yield ? "yield" : "suspend");
+            } break;
+            case TraceEventType::exit: {
+                if (running && running_task == event.task_id) end_run(event.timestamp, "exit");
+                begin_event("i", tid, event.timestamp);
+                fres += ",\"s\":\"t\",\"name\":\"exit\",\"args\":{\"task\":"; fres += std::to_string(event.task_id); fres += "}}";
+            } break;
+            case TraceEventType::wait:
+            case TraceEventType::wake: {
+                // Waits are shown as async slices per task
+                begin_event(event.type == TraceEventType::wait ? "b" : "e", tid, event.timestamp);
+                fres += ",\"cat\":\"wait\",\"name\":"; append_json_string(fres, "wait " + get_name(event.task_id));
+                fres += ",\"id\":\""; fres += std::to_string(tid); fres += ':'; fres += std::to_string(event.task_id);
+                char object[24];
+                std::snprintf(object, sizeof(object), "0x%llx", static_cast<unsigned long long>(event.object));
+                fres += "\",\"args\":{\"object\":\""; fres += object; fres += "\"}}";
+            } break;
+            }
+        }
+        // Task still running when buffer was read
+        if (!events[index].empty()) end_run(events[index].back().timestamp, "running");
+    }
+    fres += "\n]}\n";
+    return fres;
+}
+
+bool TraceExporter::write(const std::string& path) const {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out) return false;
+    out << render();
+    return static_cast<bool>(out.flush());
+}
+}
@@ -0,0 +1,232 @@
+#include "cosched2/watchdog.hpp"
+#include "cosched2/off_cpu_profile.hpp"
+#include "minicoro.h"
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#if __has_include(<pthread.h>) && __has_include(<signal.h>) && __has_include(<ucontext.h>)
+#   include <pthread.h>
+#   include <signal.h>
+#   include <ucontext.h>
+#   define COSCHED2_HAS_SIGNALS
+#endif
+
+
+
+namespace CoSched {
+namespace {
+enum CaptureState : int {
+    capture_idle,
+    capture_requested,
+    capture_writing,
+    capture_done
+};
+
+// Filled in by the signal handler, there is only one so watchdogs take turns
+struct Capture {
+    std::atomic<int> state = capture_idle;
+    std::thread::native_handle_type thread;
+    bool in_task;
+    uint64_t task_id;
+    char task_name[64];
+    Priority priority;
+    size_t frame_count;
+    uintptr_t frames[64];
+} capture_slot;
+std::mutex capture_mutex;
+}
+
+
+std::string HungTaskReport::to_string() const {
+    char buf[256];
+    const auto ms = static_cast<long long>(std::chrono::duration_cast<std::chrono::milliseconds>(running_for).count());
+    if (in_task) {
+        std::snprintf(buf, sizeof(buf), "Task \"%s\" (id %llu, priority %d) on scheduler \"%s\" has been running for %lld ms without yielding\n",
+                      task_name.c_str(), static_cast<unsigned long long>(task_id), static_cast<int>(priority), scheduler.c_str(), ms);
+    } else if (!frames.empty()) {
+        std::snprintf(buf, sizeof(buf), "Scheduler \"%s\" has been stuck outside of any task for %lld ms\n", scheduler.c_str(), ms);
+    } else {
+        std::snprintf(buf, sizeof(buf), "Scheduler \"%s\" hasn't switched for %lld ms, running task couldn't be captured\n", scheduler.c_str(), ms);
+    }
+    std::string fres = buf;
+    if (frames.empty()) fres += "    (no backtrace)\n";
+    for (size_t index = 0; index != frames.size(); index++) {
+        fres += "    #";
+        fres += std::to_string(index);
+        fres += ' ';
+        fres += symbolize_address(frames[index]);
+        fres += '\n';
+    }
+    return fres;
+}
+
+
+Watchdog::Watchdog(std::chrono::nanoseconds threshold, std::function<void (const HungTaskReport&)>&& hook)
+    : hook(std::move(hook)), threshold(CycleClock::from_ns(threshold.count())),
+      interval(std::max<std::chrono::nanoseconds>(threshold / 4, std::chrono::milliseconds(1))) {
+#ifdef COSCHED2_HAS_SIGNALS
+    signal = SIGURG;
+#else
+    signal = 0;
+#endif
+    if (!this->hook) this->hook = [] (const HungTaskReport& report) {
+        std::fputs(report.to_string().c_str(), stderr);
+    };
+}
+
+void Watchdog::handle_signal(void *ucontext) {
+#ifdef COSCHED2_HAS_SIGNALS
+    auto& slot = capture_slot;
+    int expected = capture_requested;
+    if (!slot.state.compare_exchange_strong(expected, capture_writing, std::memory_order_acquire)) return;
+    // Late signal of a capture that has been given up on may hit another thread
+    if (!pthread_equal(pthread_self(), slot.thread)) {
+        slot.state.store(capture_requested, std::memory_order_release);
+        return;
+    }
+    slot.in_task = false;
+    slot.frame_count = 0;
+    uintptr_t pc = 0, fp = 0, sp = 0;
+#   if defined(__linux__) && defined(__x86_64__)
+    const auto& mcontext = static_cast<ucontext_t*>(ucontext)->uc_mcontext;
+    pc = mcontext.gregs[REG_RIP];
+    fp = mcontext.gregs[REG_RBP];
+    sp = mcontext.gregs[REG_RSP];
+#   elif defined(__linux__) && defined(__aarch64__)
+    const auto& mcontext = static_cast<ucontext_t*>(ucontext)->uc_mcontext;
+    pc = mcontext.pc;
+    fp = mcontext.regs[29];
+    sp = mcontext.sp;
+#   else
+    (void)ucontext;
+#   endif
+    if (pc) slot.frames[slot.frame_count++] = pc;
+    // Frames are only walked within the stack of the task, those of tasks running on the schedulers stack aren't
+    uintptr_t low = 0, high = 0;
+    const Task *task = Task::current;
+    if (task && task->state == TaskState::running) {
+        slot.in_task = true;
+        slot.task_id = task->id;
+        slot.priority = task->priority;
+        const size_t name_size = std::min(task->name.size(), sizeof(slot.task_name) - 1);
+        std::memcpy(slot.task_name, task->name.data(), name_size);
+        slot.task_name[name_size] = '\0';
+        if (const auto stack = task->context.shared_stack) {
+            low = reinterpret_cast<uintptr_t>(stack->memory);
+            high = low + stack->size;
+        } else if (task->context.stack) {
+            low = reinterpret_cast<uintptr_t>(task->context.stack);
+            high = low + task->context.stack_size;
+        } else if (task->coroutine) {
+            low = reinterpret_cast<uintptr_t>(task->coroutine->stack_base);
+            high = low + task->coroutine->stack_size;
+        }
+        if (sp < low || sp >= high) high = 0;
+        else low = sp;
+    }
+    // Every frame starts with the previous frame pointer followed by the return address
+    while (slot.frame_count != sizeof(slot.frames) / sizeof(*slot.frames)) {
+        if (fp < low || fp + 2 * sizeof(uintptr_t) > high || fp % sizeof(uintptr_t)) break;
+        const auto frame = reinterpret_cast<const uintptr_t*>(fp);
+        // minicoro puts a dummy return address at the stack top
+        if (!frame[1] || frame[1] == static_cast<uintptr_t>(0xdeaddeaddeaddead)) break;
+        slot.frames[slot.frame_count++] = frame[1];
+        // Frames MUST go towards the stack top, anything else means the chain is broken
+        if (frame[0] <= fp) break;
+        fp = frame[0];
+    }
+    slot.state.store(capture_done, std::memory_order_release);
+#else
+    (void)ucontext;
+#endif
+}
+
+bool Watchdog::capture(Source& source, HungTaskReport& report) {
+#ifdef COSCHED2_HAS_SIGNALS
+    std::scoped_lock L(capture_mutex);
+    auto& slot = capture_slot;
+    slot.thread = source.thread;
+    slot.state.store(capture_requested, std::memory_order_release);
+    if (pthread_kill(source.thread, signal) != 0) {
+        slot.state.store(capture_idle, std::memory_order_relaxed);
+        return false;
+    }
+    // Give up if the signal isn't handled in time, e.g. because the thread is blocking it
+    const auto give_up_at = std::chrono::steady_clock::now() + std::chrono::milliseconds(100);
+    for (int state; (state = slot.state.load(std::memory_order_acquire)) != capture_done;) {
+        if (state == capture_requested && std::chrono::steady_clock::now() >= give_up_at) {
+            int expected = capture_requested;
+            if (slot.state.compare_exchange_strong(expected, capture_idle, std::memory_order_relaxed)) return false;
+        }
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+    report.in_task = slot.in_task;
+    if (slot.in_task) {
+        report.task_id = slot.task_id;
+        report.task_name = slot.task_name;
+        report.priority = slot.priority;
+    }
+    report.frames.assign(slot.frames, slot.frames + slot.frame_count);
+    slot.state.store(capture_idle, std::memory_order_relaxed);
+    return true;
+#else
+    (void)source;
+    (void)report;
+    return false;
+#endif
+}
+
+void Watchdog::check(Source& source) {
+    // Hangs are only possible while the scheduler is running tasks
+    const auto resumed_at = source.scheduler->last_resumed_at.load(std::memory_order_relaxed);
+    if (!resumed_at || resumed_at == source.reported_resume || source.scheduler->idle_since.load(std::memory_order_relaxed)) return;
+    const auto now = CycleClock::now();
+    if (now < resumed_at || now - resumed_at < threshold) return;
+    source.reported_resume = resumed_at;
+    HungTaskReport report;
+    report.scheduler = source.name;
+    report.running_for = std::chrono::nanoseconds(CycleClock::to_ns(now - resumed_at));
+    capture(source, report);
+    // Scheduler may have switched while being captured, the hang is over then
+    if (source.scheduler->last_resumed_at.load(std::memory_order_relaxed) != resumed_at) return;
+    hook(report);
+}
+
+void Watchdog::main_loop() {
+    std::unique_lock L(mutex);
+    while (!stop_condition.wait_for(L, interval, [this] () {return stop_requested;})) {
+        L.unlock();
+        for (auto& source : sources) {
+            check(source);
+        }
+        L.lock();
+    }
+}
+
+void Watchdog::start() {
+#ifdef COSCHED2_HAS_SIGNALS
+    struct sigaction action{};
+    action.sa_sigaction = [] (int, siginfo_t *, void *ucontext) {
+        handle_signal(ucontext);
+    };
+    action.sa_flags = SA_SIGINFO | SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(signal, &action, nullptr);
+#endif
+    stop_requested = false;
+    thread = std::thread([this] () {
+        main_loop();
+    });
+}
+
+void Watchdog::stop() {
+    if (!thread.joinable()) return;
+    {
+        std::scoped_lock L(mutex);
+        stop_requested = true;
+    }
+    stop_condition.notify_one();
+    thread.join();
+}
+}